@@ -48,14 +48,37 @@ def find_files(folder: str, depth: int = 4) -> list:
     return out
 
 
+def include_order(headers: list) -> list:
+    deps = {}
+    for h in headers:
+        with open(h, "r") as file:
+            deps[h] = [os.path.dirname(h) + "/" + line.split("\"")[1] for line in file if "#include \"" in line]
+
+    out = []
+
+    def visit(h: str, seen: list):
+        if h in out or h in seen:
+            return
+        seen.append(h)
+        for d in deps[h]:
+            if d in deps:
+                visit(d, seen)
+        out.append(h)
+
+    for h in sorted(headers):
+        visit(h, [])
+
+    return out
+
+
 path = "src"
 outfile = "release/task_manager.hpp"
 exclude = ["main.cpp"]
 
 files = find_files(path)
 
-headers = [x for x in files if x.endswith(".h")]
-sources = [x for x in files if x.endswith(".cpp") if "main.cpp" not in x]
+headers = include_order([x for x in files if x.endswith(".h")])
+sources = sorted([x for x in files if x.endswith(".cpp") if "main.cpp" not in x])
 
 includes = ""
 h_and_s = ""
@@ -2,22 +2,485 @@
 // *                                             *
 // * An amalgamation of the task_manager library *
 // * By Christian                                *
-// * 2 .h                                        *
+// * 11 .h                                       *
 // * 1 .cpp                                      *
 // *                                             *
 // ***********************************************
 
+#include <chrono>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+#include <fstream>
+#include <string>
 #include <vector>
 #include <functional>
+#include <new>
 #include <algorithm>
 #include <mutex>
-#include <string>
 #include <any>
 #include <queue>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <memory>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <type_traits>
+#include <utility>
+#include <cerrno>
 #include <future>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <random>
+
+
+// ************************
+// * Start of src/cache.h *
+// ************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CACHE_H_
+#define TASK_MANAGER_SRC_CACHE_H_
+
+
+namespace unmined {
+
+/**
+ * @brief A bounded least recently used cache, where entries can also expire after a time to live
+ * @tparam K The type of the key
+ * @tparam V The type of the value
+ */
+template<typename K, typename V>
+class lru_cache {
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct entry {
+    K key;
+    V value;
+    clock::time_point stored;
+  };
+
+  /// The entries, most recently used first
+  std::list<entry> order_;
+  /// The entries by key, pointing into order_
+  std::unordered_map<K, typename std::list<entry>::iterator> index_;
+  /// The max amount of entries, 0 stores nothing
+  size_t capacity_;
+  /// How long an entry lives for, 0 lives forever
+  std::chrono::milliseconds ttl_;
+
+ public:
+  /**
+   * @brief Makes a new cache
+   * @param capacity size_t - The max amount of entries
+   * @param ttl milliseconds - How long an entry lives for, 0 for forever
+   */
+  explicit lru_cache(size_t capacity = 0, std::chrono::milliseconds ttl = std::chrono::milliseconds(0))
+      : capacity_(capacity), ttl_(ttl) {}
+
+  /**
+   * @brief Gets an entry and marks it as the most recently used
+   * @param key K - The key of the entry
+   * @return optional<V> - The value, or nothing if it is missing or expired
+   */
+  std::optional<V> get(const K &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) return std::nullopt;
+    if (ttl_.count() > 0 && clock::now() - it->second->stored > ttl_) {
+      order_.erase(it->second);
+      index_.erase(it);
+      return std::nullopt;
+    }
+    order_.splice(order_.begin(), order_, it->second);
+    return it->second->value;
+  }
+
+  /**
+   * @brief Stores an entry, evicting the least recently used one if full
+   * @param key K - The key of the entry
+   * @param value V - The value of the entry
+   */
+  void put(const K &key, V value) {
+    if (capacity_ == 0) return;
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      order_.erase(it->second);
+      index_.erase(it);
+    }
+    order_.push_front({key, std::move(value), clock::now()});
+    index_[key] = order_.begin();
+    while (index_.size() > capacity_) {
+      index_.erase(order_.back().key);
+      order_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Changes the capacity and time to live, evicting what no longer fits
+   * @param capacity size_t - The max amount of entries
+   * @param ttl milliseconds - How long an entry lives for, 0 for forever
+   */
+  void resize(size_t capacity, std::chrono::milliseconds ttl) {
+    capacity_ = capacity;
+    ttl_ = ttl;
+    while (index_.size() > capacity_) {
+      index_.erase(order_.back().key);
+      order_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Removes every entry
+   */
+  void clear() {
+    order_.clear();
+    index_.clear();
+  }
+
+  /**
+   * @brief Gets the amount of entries
+   * @return size_t - The amount of entries, expired ones included
+   */
+  size_t size() const {
+    return index_.size();
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_CACHE_H_
+
+// **************************
+// * Start of src/capture.h *
+// **************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CAPTURE_H_
+#define TASK_MANAGER_SRC_CAPTURE_H_
+
+
+namespace unmined {
+
+/**
+ * @brief What a capture keeps of a task, everything but what it does
+ */
+struct capture_record {
+  /// When the task was added, in nanoseconds since the capture started
+  int64_t submitted = 0;
+  /// The wall time the task ran for, in nanoseconds
+  uint64_t runtime = 0;
+  /// The CPU time the task ran for, in nanoseconds
+  uint64_t cpu = 0;
+  /// The size of the result
+  uint64_t result_size = 0;
+  std::string name;
+  std::string pool;
+  std::string after;
+};
+
+/**
+ * @brief Writes capture records to a file
+ *
+ * The file is the 8 byte magic "TMCAP001", then each record as varints (the submit time zigzag encoded) and length
+ * prefixed strings, in the order the tasks ran.
+ */
+class capture_writer {
+ private:
+  std::ofstream out_;
+  std::string buf_;
+
+  void _varint(uint64_t v) {
+    while (v >= 0x80) {
+      buf_ += (char) (v | 0x80);
+      v >>= 7;
+    }
+    buf_ += (char) v;
+  }
+
+  void _string(const std::string &s) {
+    _varint(s.size());
+    buf_ += s;
+  }
+
+ public:
+  static constexpr char MAGIC[8] = {'T', 'M', 'C', 'A', 'P', '0', '0', '1'};
+
+  /**
+   * @brief Opens a capture file, replacing any that's there
+   * @param path string - The path of the file
+   */
+  explicit capture_writer(const std::string &path) : out_(path, std::ios::binary | std::ios::trunc) {
+    out_.write(MAGIC, sizeof(MAGIC));
+  }
+
+  ~capture_writer() {
+    flush();
+  }
+
+  /**
+   * @brief Checks if the file opened
+   * @return bool - If records can be written
+   */
+  bool good() const {
+    return out_.good();
+  }
+
+  /**
+   * @brief Adds a record, written out once 64KiB are buffered or on flush
+   * @param r capture_record - The record
+   */
+  void write(const capture_record &r) {
+    _varint(((uint64_t) r.submitted << 1) ^ (uint64_t) (r.submitted >> 63));
+    _varint(r.runtime);
+    _varint(r.cpu);
+    _varint(r.result_size);
+    _string(r.name);
+    _string(r.pool);
+    _string(r.after);
+    if (buf_.size() >= 1 << 16) flush();
+  }
+
+  /**
+   * @brief Writes out the buffered records
+   */
+  void flush() {
+    out_.write(buf_.data(), (std::streamsize) buf_.size());
+    out_.flush();
+    buf_.clear();
+  }
+};
+
+/**
+ * @brief Reads every record of a capture file
+ * @param path string - The path of the file
+ * @return vector<capture_record> - The records in the order the tasks ran, empty if the file isn't a capture
+ */
+inline std::vector<capture_record> read_capture(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<capture_record> out;
+  if (data.compare(0, sizeof(capture_writer::MAGIC), capture_writer::MAGIC, sizeof(capture_writer::MAGIC)) != 0)
+    return out;
+
+  size_t pos = sizeof(capture_writer::MAGIC);
+  bool ok = true;
+  auto varint = [&]() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= data.size()) break;
+      auto b = (uint8_t) data[pos++];
+      v |= (uint64_t) (b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return v;
+  };
+  auto string = [&]() {
+    uint64_t len = varint();
+    if (!ok || len > data.size() - pos) {
+      ok = false;
+      return std::string();
+    }
+    std::string s = data.substr(pos, len);
+    pos += len;
+    return s;
+  };
+
+  while (pos < data.size()) {
+    capture_record r;
+    uint64_t zigzag = varint();
+    r.submitted = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+    r.runtime = varint();
+    r.cpu = varint();
+    r.result_size = varint();
+    r.name = string();
+    r.pool = string();
+    r.after = string();
+    // a capture cut off mid record, e.g. by a crash, keeps the records before it
+    if (!ok) break;
+    out.push_back(std::move(r));
+  }
+  return out;
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_CAPTURE_H_
+
+// *******************************
+// * Start of src/worker_local.h *
+// *******************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_WORKER_LOCAL_H_
+#define TASK_MANAGER_SRC_WORKER_LOCAL_H_
+
+#include <vector>
+
+namespace unmined {
+
+namespace detail {
+
+/// The size values are padded and aligned to, so two workers' values never share a cache line
+constexpr size_t CACHE_LINE = 64;
+
+/**
+ * @brief The worker local values of one thread
+ */
+class local_storage {
+ private:
+  struct slot {
+    /// The worker_local the value belongs to
+    const void *owner;
+    void *value;
+    void (*destroy)(void *);
+  };
+
+  /// The values, in the order they were made
+  std::vector<slot> slots_;
+
+ public:
+  ~local_storage() {
+    clear();
+  }
 
+  /**
+   * @brief Finds the value of a worker_local
+   * @param owner void* - The worker_local
+   * @return void* - The value, or nullptr if it wasn't made yet
+   */
+  void *find(const void *owner) {
+    for (auto &s: slots_) {
+      if (s.owner == owner) return s.value;
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Adds the value of a worker_local
+   * @param owner void* - The worker_local
+   * @param value void* - The value
+   * @param destroy function - Destroys and frees the value
+   */
+  void add(const void *owner, void *value, void (*destroy)(void *)) {
+    slots_.push_back({owner, value, destroy});
+  }
+
+  /**
+   * @brief Destroys every value, newest first
+   */
+  void clear() {
+    while (!slots_.empty()) {
+      slot s = slots_.back();
+      slots_.pop_back();
+      s.destroy(s.value);
+    }
+  }
+};
+
+/// The worker local values of the calling thread
+inline thread_local local_storage storage;
+/// The values used instead of storage, set by simulate to the values of the virtual worker running a task
+inline thread_local local_storage *storage_override = nullptr;
+/// The ID of the worker the calling thread is, -1 if it isn't one
+inline thread_local int current_worker = -1;
+
+/**
+ * @brief Gets the worker local values of the worker running on the calling thread
+ * @return local_storage& - The values
+ */
+inline local_storage &current_storage() {
+  return storage_override ? *storage_override : storage;
+}
+
+}
+
+/**
+ * @brief Gets the ID of the worker running the calling task
+ * @return int - The worker ID, or -1 when not called from a worker
+ */
+inline int worker_id() {
+  return detail::current_worker;
+}
+
+/**
+ * @brief A value that each worker gets its own of, made the first time that worker uses it
+ *
+ * Workers destroy their values when they stop, after on_worker_stop, newest first. Under simulate each virtual worker
+ * has its own values, destroyed when simulate returns. Values are on their own cache lines. A worker_local should outlive the task manager, e.g. as a static, since values are found by its address.
+ * @tparam T The type of the value
+ */
+template<typename T>
+class worker_local {
+ private:
+  /// Makes the value for a worker
+  std::function<T()> make_;
+
+  static constexpr size_t SIZE = (sizeof(T) + detail::CACHE_LINE - 1) / detail::CACHE_LINE * detail::CACHE_LINE;
+  static constexpr std::align_val_t ALIGN{alignof(T) > detail::CACHE_LINE ? alignof(T) : detail::CACHE_LINE};
+
+  static void _destroy(void *p) {
+    static_cast<T *>(p)->~T();
+    ::operator delete(p, SIZE, ALIGN);
+  }
+
+ public:
+  /**
+   * @brief Makes a new worker local value
+   * @param make function - Makes the value for a worker, defaults to T()
+   */
+  explicit worker_local(std::function<T()> make = []() { return T(); }) : make_(std::move(make)) {}
+
+  worker_local(const worker_local &) = delete;
+  void operator=(const worker_local &) = delete;
+
+  /**
+   * @brief Gets the calling worker's value, making it if needed
+   * @return T& - The value
+   */
+  T &get() {
+    detail::local_storage &storage = detail::current_storage();
+    if (void *found = storage.find(this)) return *static_cast<T *>(found);
+    T *value = new(::operator new(SIZE, ALIGN)) T(make_());
+    storage.add(this, value, &_destroy);
+    return *value;
+  }
+
+  T &operator*() {
+    return get();
+  }
+
+  T *operator->() {
+    return &get();
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_WORKER_LOCAL_H_
 
 // *******************************
 // * Start of src/task_manager.h *
@@ -30,11 +493,16 @@
 #ifndef TASK_MANAGER__TASK_MANAGER_H_
 #define TASK_MANAGER__TASK_MANAGER_H_
 
+#include <vector>
+#include <functional>
+#include <string>
 
 #define GUARD(x) std::lock_guard<std::mutex> guard(x)
 #define EVAL(x, y) ((x & y) == (y))
 #define SET_ON(x, y) x |= y
 #define SET_OFF(x, y) x &= ~y
+/// Calls a hook of the HOOKS policy, or nothing if the policy doesn't have it
+#define HOOK(name, ...) if constexpr (requires { this->name(__VA_ARGS__); }) this->name(__VA_ARGS__)
 
 namespace unmined {
 
@@ -46,6 +514,12 @@ using namespace std::chrono_literals;
 enum tm_settings {
   KILL_ON_EMPTY = 1,
   IN_ORDER = 1 << 1,
+  /// Measures the CPU time, wall time and context switches of every task
+  TRACK_USAGE = 1 << 2,
+  /// Keeps results in their pools even when they're sent to a sink
+  KEEP_POOLS = 1 << 3,
+  /// Workers run the tasks queued for them by affinity before their pools' turns, ignoring the pool weights
+  AFFINITY_FIRST = 1 << 4,
 };
 
 /**
@@ -60,6 +534,18 @@ enum task_settings {
    * @brief The pool (vector) that the task should return to
    */
   POOL = 1,
+  /**
+   * @brief The key of the task, tasks with the same key share a single run and its result
+   */
+  KEY = 2,
+  /**
+   * @brief How long the task takes in simulate, in nanoseconds
+   */
+  COST = 3,
+  /**
+   * @brief Tasks with the same affinity prefer to run on the same worker
+   */
+  AFFINITY = 4,
   /// The ID of the task, will be overwritten by the task manager
   ID = -1,
 };
@@ -70,74 +556,234 @@ struct retype {
 };
 
 /**
- * @brief The task container, contains a name, a function, and settings
+ * @brief The counters for keyed tasks
  */
-struct task {
-  std::string name; // the name of the task
-  std::function<retype()> func; // the function to be _run for said task
-  std::unordered_map<enum task_settings, std::string> settings{ // the settings of the tesk
-      {AFTER, ""},
-      {POOL, name},
-  };
-  int id = -1;
+struct cache_stats {
+  /// Tasks that were given a cached result
+  uint64_t hits = 0;
+  /// Tasks that were attached to an in-flight task with the same key
+  uint64_t joins = 0;
+  /// Tasks that had to be run
+  uint64_t misses = 0;
 };
 
+namespace detail {
+/// The blocking counter of the worker the calling thread is, nullptr if it isn't one
+inline thread_local std::atomic<int> *current_blocking = nullptr;
+}
+
 /**
- * @brief The task manager class
- * @tparam WORKER_COUNT The amount of worker threads, default 4
+ * @brief Marks the calling worker as blocked while it's in scope, so the task manager can run a compensation worker
+ *
+ * Does nothing when not on a worker.
  */
-template<int WORKER_COUNT = 4>
-class task_manager {
+class blocking_region {
  private:
-  /// The singleton instance
-  static task_manager<WORKER_COUNT> *instance_;
+  std::atomic<int> *blocking_ = detail::current_blocking;
 
-  /// The main running thread, so that the main program can do other things
-  std::thread main_thread_;
-  /// The array of worker threads
-  std::array<std::thread, WORKER_COUNT> workers_;
+ public:
+  blocking_region() {
+    if (blocking_) blocking_->fetch_add(1, std::memory_order_relaxed);
+  }
+  ~blocking_region() {
+    if (blocking_) blocking_->fetch_sub(1, std::memory_order_relaxed);
+  }
+  blocking_region(const blocking_region &) = delete;
+  void operator=(const blocking_region &) = delete;
+};
 
-  /// The queue of tasks
-  std::deque<task> queue_;
-  /// A vector of the done tasks' names
-  std::vector<std::string> done_;
-  /// A map of the pools that functions can return to
-  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools_;
-  /// The next available task IDs for which pool
-  std::unordered_map<std::string, int> pool_ntIDs;
-  /// If the task manager is paused
-  bool is_paused_ = true;
-  /// If the task manager is stopped, will kill the task manager cleanly
-  bool stop_ = false;
-  /// The settings, only 2 exist, but there are 16 possible
-  uint16_t settings_ = 0 | (~KILL_ON_EMPTY | IN_ORDER);
+/**
+ * @brief The counters for compensation workers
+ */
+struct compensation_stats {
+  /// Compensation workers started
+  uint64_t spawned = 0;
+  /// Compensation workers that stopped once the blocked workers came back
+  uint64_t retired = 0;
+  /// The most compensation workers running at once
+  uint64_t peak = 0;
+};
 
-  // the mutexes for each variable that will be modified
-  std::mutex settings_lock_;
-  std::mutex is_paused_lock_;
-  std::mutex kill_lock_;
-  std::mutex done_lock_;
-  std::mutex queue_lock_;
-  std::mutex pools_lock_;
-  std::mutex pool_ntids_lock_;
+/**
+ * @brief The counters for tasks with an affinity
+ */
+struct affinity_stats {
+  /// Tasks run by the worker their affinity maps to
+  uint64_t local = 0;
+  /// Tasks taken from another worker's queue by an idle worker
+  uint64_t stolen = 0;
+  /// Tasks sent to the shared queue because their worker had too many queued
+  uint64_t spilled = 0;
+};
 
- public:
-  // TODO: REWORK THIS, maybe make them private or sm
+/**
+ * @brief The time and context switches used by a thread
+ */
+struct thread_usage {
+  /// The time passed
+  std::chrono::nanoseconds wall{0};
+  /// The time spent on the CPU
+  std::chrono::nanoseconds cpu{0};
+  /// The times the thread gave up the CPU, usually to wait on I/O or a lock
+  uint64_t voluntary_switches = 0;
+  /// The times the thread was taken off the CPU by the scheduler
+  uint64_t involuntary_switches = 0;
+};
+
+/**
+ * @brief The usage of the tasks run by a pool or a worker
+ */
+struct task_stats {
+  /// The amount of tasks run
+  uint64_t count = 0;
+  /// The usage of every task, summed
+  thread_usage total;
+  /// The longest wall time of a task
+  std::chrono::nanoseconds max_wall{0};
+  /// The longest CPU time of a task
+  std::chrono::nanoseconds max_cpu{0};
 
   /**
-   * @brief The function called when a task starts
-   * @param t task - The task
-   * @param wid int - The worker ID
+   * @brief Adds a task, from the usage sampled before and after it ran
+   * @param before thread_usage - The usage before the task
+   * @param after thread_usage - The usage after the task
    */
-  std::function<void(const task &t, const int &wid)> task_start_callback
-      = [](const task &t, const int &wid) {};
+  void add(const thread_usage &before, const thread_usage &after) {
+    auto wall = after.wall - before.wall;
+    auto cpu = after.cpu - before.cpu;
+    count++;
+    total.wall += wall;
+    total.cpu += cpu;
+    total.voluntary_switches += after.voluntary_switches - before.voluntary_switches;
+    total.involuntary_switches += after.involuntary_switches - before.involuntary_switches;
+    max_wall = std::max(max_wall, wall);
+    max_cpu = std::max(max_cpu, cpu);
+  }
+
   /**
-   * @brief The function called when a task finishes
-   * @param t task - The task
-   * @param wid int - The worker ID
+   * @brief Gets how much of the wall time was spent on the CPU, near 1 is CPU bound, near 0 is blocked on I/O
+   * @return double - The CPU time over the wall time
    */
-  std::function<void(const task &t, const int &wid)> task_stop_callback
-      = [](const task &t, const int &wid) {};
+  double cpu_ratio() const {
+    return total.wall.count() ? (double) total.cpu.count() / (double) total.wall.count() : 0;
+  }
+};
+
+/**
+ * @brief The last times tasks of a pool waited in the queue, kept with TRACK_USAGE
+ */
+struct wait_stats {
+  /// The amount of waits kept
+  static constexpr size_t KEPT = 1024;
+
+  /// The last KEPT waits, oldest overwritten first
+  std::vector<std::chrono::nanoseconds> samples;
+  /// Where the next wait goes once samples is full
+  size_t next = 0;
+
+  /**
+   * @brief Adds a wait
+   * @param wait nanoseconds - The time a task spent queued
+   */
+  void add(std::chrono::nanoseconds wait) {
+    if (samples.size() < KEPT) samples.push_back(wait);
+    else samples[next] = wait;
+    next = (next + 1) % KEPT;
+  }
+
+  /**
+   * @brief Gets a percentile of the kept waits
+   * @param p double - The percentile, from 0 to 100
+   * @return nanoseconds - The wait that p percent of the waits are at or under
+   */
+  std::chrono::nanoseconds percentile(double p) const {
+    if (samples.empty()) return std::chrono::nanoseconds(0);
+    auto sorted = samples;
+    size_t i = std::min(sorted.size() - 1, (size_t) (std::clamp(p, 0.0, 100.0) / 100.0 * (double) sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + (long) i, sorted.end());
+    return sorted[i];
+  }
+};
+
+/**
+ * @brief A task run by simulate, on the virtual clock
+ */
+struct sim_event {
+  std::string name;
+  int wid;
+  std::chrono::nanoseconds start;
+  std::chrono::nanoseconds end;
+};
+
+/**
+ * @brief The outcome of simulate
+ */
+struct sim_report {
+  /// The virtual time the last task finished at
+  std::chrono::nanoseconds makespan{0};
+  /// The amount of tasks run
+  uint64_t tasks = 0;
+  /// The times a task was put back because the task it's after wasn't done
+  uint64_t requeues = 0;
+  /// The tasks left in the queue that could never run
+  uint64_t stuck = 0;
+  /// Every task run, in the order they finished
+  std::vector<sim_event> trace;
+};
+
+/**
+ * @brief A finished task's result, as given to a result sink
+ */
+struct task_result {
+  std::string name;
+  std::string pool;
+  int id;
+  retype value;
+};
+
+/**
+ * @brief A function results are given to as tasks finish, called from the worker that ran the task
+ */
+using result_sink = std::function<void(task_result &&r)>;
+
+template<typename T>
+class channel;
+
+/**
+ * @brief The task container, contains a name, a function, and settings
+ */
+struct task {
+  std::string name; // the name of the task
+  std::function<retype()> func; // the function to be _run for said task
+  std::unordered_map<enum task_settings, std::string> settings{ // the settings of the tesk
+      {AFTER, ""},
+      {POOL, name},
+  };
+  int id = -1;
+  /// When the task was added to the queue
+  std::chrono::steady_clock::time_point queued{};
+  /// Called once the task's result is in its pool or sent to the sink, e.g. to record that it finished
+  std::function<void(const retype &)> finished{};
+};
+
+/**
+ * @brief The default hooks, which call std::function callbacks that can be set at runtime
+ */
+struct callback_hooks {
+  /**
+   * @brief The function called when a task starts
+   * @param t task - The task
+   * @param wid int - The worker ID
+   */
+  std::function<void(const task &t, const int &wid)> task_start_callback
+      = [](const task &t, const int &wid) {};
+  /**
+   * @brief The function called when a task finishes
+   * @param t task - The task
+   * @param wid int - The worker ID
+   */
+  std::function<void(const task &t, const int &wid)> task_stop_callback
+      = [](const task &t, const int &wid) {};
   /**
    * @brief The function called when a task fails
    * @param t task - The task
@@ -152,111 +798,2183 @@ class task_manager {
    */
   std::function<void(const int &wid)> worker_start_callback = [](const int &wid) {};
 
-  /**
-   * @brief The function called when a worker stops
-   * @param wid int - The worker ID
-   */
-  std::function<void(const int &wid)> worker_stop_callback = [](const int &wid) {};
+  /**
+   * @brief The function called when a worker stops
+   * @param wid int - The worker ID
+   */
+  std::function<void(const int &wid)> worker_stop_callback = [](const int &wid) {};
+
+  void on_task_start(const task &t, int wid) { task_start_callback(t, wid); }
+  void on_task_stop(const task &t, int wid) { task_stop_callback(t, wid); }
+  void on_task_fail(const task &t, int wid, int err) { task_fail_callback(t, wid, err); }
+  void on_worker_start(int wid) { worker_start_callback(wid); }
+  void on_worker_stop(int wid) { worker_stop_callback(wid); }
+};
+
+/**
+ * @brief Hooks that do nothing, so the workers don't call anything around a task
+ */
+struct no_hooks {};
+
+namespace detail {
+/// Has a member named after every hook, so naming one through hook_probe is ambiguous when the policy has it too
+struct hook_names {
+  int on_task_start, on_task_stop, on_task_fail, on_worker_start, on_worker_stop;
+};
+
+template<typename HOOKS>
+struct hook_probe : HOOKS, hook_names {};
+}
+
+/// Fails to compile if the HOOKS policy has the hook, but it can't be called with the hook's arguments
+#define HOOK_CHECK(name, ...) \
+  static_assert(requires { &detail::hook_probe<HOOKS>::name; } \
+                    || requires(HOOKS &h, const task &t, int wid, int err) { h.name(__VA_ARGS__); }, \
+                "the HOOKS policy has " #name ", but it can't be called as " #name "(" #__VA_ARGS__ ")")
+
+/**
+ * @brief The task manager class
+ *
+ * The HOOKS policy is a base of the task manager, and can have any of on_task_start(const task &, int),
+ * on_task_stop(const task &, int), on_task_fail(const task &, int, int), on_worker_start(int) and
+ * on_worker_stop(int). The ones it has are called directly so they can inline, the ones it doesn't have aren't
+ * called at all. One it has that can't be called with those arguments doesn't compile.
+ * @tparam WORKER_COUNT The amount of worker threads, default 4
+ * @tparam HOOKS The hooks called around tasks and workers, default callback_hooks
+ */
+template<int WORKER_COUNT = 4, typename HOOKS = callback_hooks>
+class task_manager : public HOOKS {
+  HOOK_CHECK(on_task_start, t, wid);
+  HOOK_CHECK(on_task_stop, t, wid);
+  HOOK_CHECK(on_task_fail, t, wid, err);
+  HOOK_CHECK(on_worker_start, wid);
+  HOOK_CHECK(on_worker_stop, wid);
+
+ private:
+  /// The singleton instance
+  static task_manager *instance_;
+
+  /// The main running thread, so that the main program can do other things
+  std::thread main_thread_;
+  /// The most workers that can run at once, compensation workers included
+  static constexpr int MAX_WORKERS = WORKER_COUNT * 2;
+
+  /// What the monitor can see of a worker
+  struct alignas(64) worker_state {
+    /// When the current task started in steady clock nanoseconds, 0 if idle
+    std::atomic<int64_t> busy_since{0};
+    /// The amount of blocking_regions the worker is in
+    std::atomic<int> blocking{0};
+    /// If a worker is running in this slot
+    std::atomic<bool> running{false};
+  };
+
+  /// The array of worker threads, compensation workers after the first WORKER_COUNT
+  std::array<std::thread, MAX_WORKERS> workers_;
+  /// The state of each worker
+  std::array<worker_state, MAX_WORKERS> states_;
+  /// The amount of the first WORKER_COUNT workers still running
+  std::atomic<int> live_{0};
+  /// How long a task runs before its worker counts as blocked, 0 only counts blocking_regions
+  std::chrono::milliseconds block_threshold_{0};
+  /// The most compensation workers at once, 0 turns compensation off
+  int compensation_cap_ = 0;
+  /// The amount of compensation workers wanted right now
+  int compensation_target_ = 0;
+  /// The amount of compensation workers running
+  int compensating_ = 0;
+  /// The counters for compensation workers
+  struct compensation_stats compensation_stats_;
+
+  /// The queued tasks of one pool, with its place in the fair scheduling
+  struct pool_queue {
+    std::string name;
+    std::deque<task> tasks;
+    int weight = 1;
+    /// How many more tasks the pool can take this turn
+    int deficit = 0;
+    /// How many of the pool's tasks are queued for a worker by affinity instead
+    size_t local = 0;
+  };
+
+  /// The queues of tasks by pool, a pool's queue only exists while it has tasks
+  std::unordered_map<std::string, pool_queue> queue_;
+  /// The pools with tasks, in the order they take turns
+  std::deque<pool_queue *> active_;
+  /// The weights set with set_weight, other pools have a weight of 1
+  std::unordered_map<std::string, int> weights_;
+  /// The tasks queued for each worker by their affinity
+  std::array<std::deque<task>, WORKER_COUNT> local_;
+  /// How many tasks a worker can have queued by affinity before more go to the shared queue
+  size_t spill_limit_ = 1024;
+  /// How many tasks a worker has to have queued by affinity before idle workers steal from it
+  size_t steal_backlog_ = 16;
+  /// The counters for tasks with an affinity
+  struct affinity_stats affinity_stats_;
+  /// If simulate is running, so stealing doesn't depend on the state of the real workers
+  bool simulating_ = false;
+  /// The amount of tasks in every queue
+  size_t queued_ = 0;
+  /// The done tasks' names, with how many times each is in done_order_
+  std::unordered_map<std::string, size_t> done_;
+  /// The names of the last done_limit_ tasks to finish, oldest first, empty without a limit
+  std::deque<std::string> done_order_;
+  /// How many done names are kept for tasks added later, 0 for all of them, names queued tasks are after are kept either way
+  size_t done_limit_ = 0;
+  /// How many queued tasks are after each name
+  std::unordered_map<std::string, size_t> refs_;
+  /// A map of the pools that functions can return to
+  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools_;
+  /// The next available task IDs for which pool
+  std::unordered_map<std::string, int> pool_ntIDs;
+  /// The keys of queued or running tasks, with the tasks waiting on their result
+  std::unordered_map<std::string, std::vector<task>> in_flight_;
+  /// The results of finished keyed tasks
+  lru_cache<std::string, retype> results_{1024};
+  /// The counters for keyed tasks
+  struct cache_stats cache_stats_;
+  /// The usage of the tasks by pool, only kept with TRACK_USAGE
+  std::unordered_map<std::string, task_stats> pool_stats_;
+  /// The last queue waits by pool, only kept with TRACK_USAGE
+  std::unordered_map<std::string, wait_stats> waits_;
+  /// The usage of the tasks by worker, only kept with TRACK_USAGE
+  std::array<task_stats, MAX_WORKERS> worker_stats_;
+  /// Where results go instead of their pools, if set
+  std::shared_ptr<result_sink> sink_;
+  /// The channel sink_ feeds, if it was set by stream
+  std::shared_ptr<channel<task_result>> stream_;
+  /// Where the tasks run are written to while capturing
+  std::unique_ptr<capture_writer> capture_;
+  /// When the capture started, submit times are from here
+  std::chrono::steady_clock::time_point capture_start_;
+  /// If capture_ is open, so the workers can check without capture_lock_
+  std::atomic<bool> capturing_{false};
+  /// If the task manager is paused
+  bool is_paused_ = true;
+  /// If the task manager is stopped, will kill the task manager cleanly
+  bool stop_ = false;
+  /// The settings, only 2 exist, but there are 16 possible
+  uint16_t settings_ = IN_ORDER;
+
+  // the mutexes for each variable that will be modified
+  std::mutex settings_lock_;
+  std::mutex is_paused_lock_;
+  std::mutex kill_lock_;
+  std::mutex done_lock_;
+  std::mutex queue_lock_;
+  std::mutex pools_lock_;
+  std::mutex pool_ntids_lock_;
+  std::mutex keys_lock_;
+  std::mutex stats_lock_;
+  std::mutex compensation_lock_;
+  std::mutex capture_lock_;
+  std::mutex sink_lock_;
+
+ private:
+  /// makes a new task manager, do not use this
+  task_manager();
+  /// deletes the task manager safely
+  ~task_manager();
+
+  /**
+   * @brief The run function that starts all the workers, then watches them for blocking until they stop
+   */
+  void _run();
+  /**
+   * @brief Counts the blocked workers, and starts compensation workers for them while there are tasks waiting
+   * @return bool - If compensation is on
+   */
+  bool _monitor();
+  /**
+   * @brief Checks if a compensation worker should stop, and marks it as stopped if so
+   * @return bool - If there are more compensation workers than blocked workers
+   */
+  bool _retire();
+  /**
+   * @brief Starts a worker with an ID
+   * @param id int - The ID of the worker
+   */
+  void _run_worker(int id);
+
+  /**
+   * @brief Gets the next task for a worker and removes it
+   *
+   * The pools take turns by their weight, and in its pool's turn the worker's own affinity queue comes first, a pool with
+   * only other workers' affinity tasks passes its turn. Then the worker steals from the longest affinity queue of another
+   * worker that's past the steal backlog or has stopped. With AFFINITY_FIRST the worker's own queue goes before the pools.
+   * @param wid int - The worker ID
+   * @param skip_local bool - If the worker's own queue goes last, after its front task wasn't ready
+   * @return task - The next task, or an empty task if there are none the worker can take
+   */
+  task _pop_queue(int wid, bool skip_local = false);
+
+  /**
+   * @brief Adds a task to the back of its affinity's worker queue, or of its pool's queue
+   * @param task task - The task
+   */
+  void _push(task task);
+
+  /**
+   * @brief Checks if a task can run now, putting it back in the queue if it can't
+   * @param task task - The task
+   * @return bool - If the task can run
+   */
+  bool _ready(task &task);
+
+  /**
+   * @brief Adds a name to the done names, dropping the oldest past done_limit_ (if set) that no queued task is after,
+   * must hold done_lock_
+   * @param name string - The name of the task
+   */
+  void _done(const std::string &name);
+
+  /**
+   * @brief Runs a task, with its callbacks
+   * @param task task - The task
+   * @param id int - The worker ID
+   * @return retype - The result of the task
+   */
+  retype _start(task &task, int id);
+
+  /**
+   * @brief Stores the result of a task that ran, and of any tasks waiting on it
+   * @param task task - The task
+   * @param result retype - The result of the task
+   * @param id int - The worker ID
+   */
+  void _complete(task &task, const retype &result, int id);
+
+  /**
+   * @brief Writes a task to the capture, if capturing
+   *
+   * Tasks that got their result from the cache or a task with the same key are written with no runtime.
+   * @param task task - The task
+   * @param result retype - The result of the task
+   * @param wall nanoseconds - The wall time the task ran for
+   * @param cpu nanoseconds - The CPU time the task ran for
+   */
+  void _capture(task &task, const retype &result, std::chrono::nanoseconds wall = {}, std::chrono::nanoseconds cpu = {});
+
+  /**
+   * @brief Gives the result of a task to the sink or stores it in its pool, and marks it as done
+   * @param t task - The task
+   * @param r retype - The result of the task
+   */
+  void _finish(task &t, const retype &r);
+
+ public:
+  /// you can't use this
+  task_manager(task_manager &other) = delete;
+  /// you can't use this
+  void operator=(const task_manager &) = delete;
+
+  /**
+   * @brief Gets the instance of the task manager
+   * @return task_manager* - The task manager instance
+   */
+  static task_manager *get_instance();
+
+  /**
+   * @brief Adds a task to the queue of tasks to be done
+   * @param task task - The task to be done, will be last in the order
+   */
+  void add(task task);
+
+  /**
+   * @brief Starts fulfilling tasks
+   */
+  void start();
+  /**
+   * @brief Pauses fulfilling tasks
+   */
+  void pause();
+  /**
+   * @brief Stops the task manager and cleans it up
+   */
+  void stop();
+  /**
+   * @brief Checks if the the queue is empty
+   * @return bool - If the queue is empty
+   */
+  bool is_done();
+
+  /**
+   * @brief Joins the main task manager thread, which will wait until all tasks are complete
+   */
+  void join();
+
+  /**
+   * @brief Returns a vector of task names
+   * @return vector<string> - vector of task names
+   */
+  std::vector<std::string> tasks();
+
+  /**
+   * @brief Sets a setting
+   * @param t tm_settings - The setting to set
+   * @param val bool - The value of the setting
+   */
+  void set(tm_settings t, bool val) {
+    GUARD(settings_lock_);
+    if (val) SET_ON(settings_, t);
+    else
+      SET_OFF(settings_, t);
+  }
+
+  /**
+   * @brief Gets the current value of a setting
+   * @param mask tm_settings - The setting(s) to get
+   * @return bool - The value of the setting (true or false)
+   */
+  bool get(tm_settings mask) {
+    GUARD(settings_lock_);
+    return EVAL(settings_, mask);
+  }
+
+  /**
+   * @brief Runs every queued task on the calling thread, against a virtual clock, the same way on every run
+   *
+   * The WORKER_COUNT workers are simulated, each task takes its COST (or what cost returns) of virtual time, and
+   * the seed picks the order workers take tasks in and the order of tasks finishing at the same time. The task
+   * manager is paused and left paused, so this should be done before start().
+   * @param seed uint64_t - The seed for the order of events
+   * @param cost function - How long a task takes, defaults to its COST setting, or 1ms without one
+   * @return sim_report - The virtual time taken and the trace of every task
+   */
+  sim_report simulate(uint64_t seed, std::function<std::chrono::nanoseconds(const task &)> cost = nullptr);
+
+  /**
+   * @brief Sets how many results of keyed tasks are kept, and for how long
+   * @param capacity size_t - The max amount of results kept, 0 to disable the cache
+   * @param ttl milliseconds - How long a result is kept for, 0 for forever
+   */
+  void set_cache(size_t capacity, std::chrono::milliseconds ttl = 0ms);
+
+  /**
+   * @brief Gets the counters for keyed tasks
+   * @return cache_stats - The hits, joins and misses so far
+   */
+  struct cache_stats get_cache_stats();
+
+  /**
+   * @brief Gets the usage of the tasks run for a pool, needs TRACK_USAGE
+   * @param pool string - The name of the pool
+   * @return task_stats - The usage of the pool's tasks
+   */
+  task_stats pool_stats(const std::string &pool);
+
+  /**
+   * @brief Gets the usage of the tasks run by a worker, needs TRACK_USAGE
+   * @param wid int - The worker ID
+   * @return task_stats - The usage of the worker's tasks
+   */
+  task_stats worker_stats(int wid);
+
+  /**
+   * @brief Gets the usage of the tasks run for every pool, needs TRACK_USAGE
+   * @return unordered_map<string, task_stats> - The usage by pool name
+   */
+  std::unordered_map<std::string, task_stats> pools_stats();
+
+  /**
+   * @brief Sets the share of the workers a pool gets when other pools also have tasks queued
+   *
+   * Pools take turns with deficit round robin, each turn a pool can start up to its weight in tasks.
+   * @param pool string - The name of the pool
+   * @param weight int - The weight, at least 1, pools default to 1
+   */
+  void set_weight(const std::string &pool, int weight);
+
+  /**
+   * @brief Gets a percentile of how long a pool's last tasks waited between being added and starting, needs TRACK_USAGE
+   * @param pool string - The name of the pool
+   * @param p double - The percentile, from 0 to 100
+   * @return nanoseconds - The wait
+   */
+  std::chrono::nanoseconds wait_percentile(const std::string &pool, double p);
+
+  /**
+   * @brief Sets how many tasks can be queued for a worker by affinity before more go to the shared queue
+   * @param limit size_t - The amount of tasks, default 1024
+   */
+  void set_spill(size_t limit);
+
+  /**
+   * @brief Sets how many tasks a worker has to have queued by affinity before idle workers steal from it
+   *
+   * Compensation workers, and any worker once the owner has stopped, steal whatever is queued.
+   * @param backlog size_t - The amount of tasks, default 16
+   */
+  void set_steal(size_t backlog);
+
+  /**
+   * @brief Gets the counters for tasks with an affinity
+   * @return affinity_stats - The local, stolen and spilled tasks so far
+   */
+  struct affinity_stats get_affinity_stats();
+
+  /**
+   * @brief Turns on compensation workers, which run queued tasks while workers are blocked
+   *
+   * A worker is blocked while it's in a blocking_region, or once its task has run longer than threshold.
+   * @param threshold milliseconds - How long a task runs before its worker counts as blocked, 0 to only use blocking_region
+   * @param cap int - The most compensation workers at once, up to WORKER_COUNT, 0 turns compensation off
+   */
+  void set_compensation(std::chrono::milliseconds threshold, int cap);
+
+  /**
+   * @brief Gets the counters for compensation workers
+   * @return compensation_stats - The spawned, retired and peak compensation workers so far
+   */
+  struct compensation_stats get_compensation_stats();
+
+  /**
+   * @brief Starts writing when, where and how long every task runs to a file, for replay
+   * @param path string - The path of the file, replaced if it exists
+   * @return bool - If the file could be opened
+   */
+  bool capture(const std::string &path);
+
+  /**
+   * @brief Stops capturing and writes out what's left
+   */
+  void stop_capture();
+
+  /**
+   * @brief Sends results to a function as tasks finish, instead of keeping them in pools
+   *
+   * Results are only kept in pools too with KEEP_POOLS. The sink is called from the workers, so a sink that blocks
+   * holds up its worker. This closes the channel of an earlier stream.
+   * @param sink result_sink - The function, nullptr to go back to keeping results in pools
+   */
+  void set_sink(result_sink sink);
+
+  /**
+   * @brief Sends results to a bounded channel as tasks finish, instead of keeping them in pools
+   *
+   * Workers wait while the channel is full, so memory stays bounded by how fast the results are taken. The channel
+   * closes once the workers stop, on stop, KILL_ON_EMPTY, or another set_sink, results after that are dropped.
+   * @param capacity size_t - The max amount of results held
+   * @return shared_ptr<channel<task_result>> - The channel to take results from
+   */
+  std::shared_ptr<channel<task_result>> stream(size_t capacity);
+
+  /**
+   * @brief Takes up to max results out of a pool, so a pool can be emptied a little at a time while tasks run
+   * @param pool string - The name of the pool
+   * @param max size_t - The most results taken
+   * @return vector<pair<int, string>> - The task IDs and results taken
+   */
+  std::vector<std::pair<int, std::string>> drain(const std::string &pool, size_t max);
+
+  /**
+   * @brief Marks a task as done without running it, so tasks AFTER it can run, e.g. when it finished before a restart
+   * @param name string - The name of the task
+   */
+  void mark_done(const std::string &name);
+
+  /**
+   * @brief Sets how many done task names are kept for AFTER, on top of the ones queued tasks are after
+   *
+   * By default every name is kept. A task added after the name it's after was dropped waits forever, so a limit should
+   * cover how far behind tasks are added, names done before a limit was set are kept.
+   * @param limit size_t - The amount of names, 0 to keep all of them
+   */
+  void set_done_limit(size_t limit);
+
+  void clear_pool(const std::string &pool);
+  /**
+   * @brief Gets a copy of every pool's results, which can be large on long runs, see pool_sizes and drain
+   * @return unordered_map - The results by pool and task ID
+   */
+  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools();
+  /**
+   * @brief Gets how many results each pool has, without copying them
+   * @return unordered_map - The amount of results by pool
+   */
+  std::unordered_map<std::string, size_t> pool_sizes();
+  std::unordered_map<int, std::string> pool(const std::string& name);
+
+};
+
+}
+
+#endif //TASK_MANAGER__TASK_MANAGER_H_
+
+// **************************
+// * Start of src/channel.h *
+// **************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CHANNEL_H_
+#define TASK_MANAGER_SRC_CHANNEL_H_
+
+#include <deque>
+#include <mutex>
+
+namespace unmined {
+
+/**
+ * @brief A bounded queue between threads, pushing blocks while it's full and popping blocks while it's empty
+ *
+ * It closes once every producer has called close, after which pops drain what's left and then fail.
+ * @tparam T The type of the items
+ */
+template<typename T>
+class channel {
+ private:
+  std::deque<T> items_;
+  /// The max amount of items held
+  size_t capacity_;
+  /// The amount of producers that haven't closed yet
+  int producers_;
+
+  std::mutex lock_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+
+ public:
+  /**
+   * @brief Makes a new channel
+   * @param capacity size_t - The max amount of items held before pushing blocks
+   * @param producers int - The amount of producers that have to close it
+   */
+  explicit channel(size_t capacity, int producers = 1) : capacity_(capacity ? capacity : 1), producers_(producers) {}
+
+  /**
+   * @brief Adds an item, waiting for room
+   * @param item T - The item
+   * @return bool - false if the channel was closed
+   */
+  bool push(T item) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_full_.wait(guard, [this]() { return items_.size() < capacity_ || producers_ <= 0; });
+    if (producers_ <= 0) return false;
+    items_.push_back(std::move(item));
+    guard.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest item, waiting for one
+   * @param out T - Where the item is moved to
+   * @return bool - false if the channel is closed and empty
+   */
+  bool pop(T &out) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_empty_.wait(guard, [this]() { return !items_.empty() || producers_ <= 0; });
+    if (items_.empty()) return false;
+    out = std::move(items_.front());
+    items_.pop_front();
+    guard.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest item if there is one, without waiting
+   * @param out T - Where the item is moved to
+   * @return bool - If an item was taken
+   */
+  bool try_pop(T &out) {
+    {
+      GUARD(lock_);
+      if (items_.empty()) return false;
+      out = std::move(items_.front());
+      items_.pop_front();
+    }
+    not_full_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Marks one producer as done, closing the channel once they all are
+   */
+  void close() {
+    {
+      GUARD(lock_);
+      producers_--;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  /**
+   * @brief Checks if every producer is done
+   * @return bool - If the channel is closed
+   */
+  bool closed() {
+    GUARD(lock_);
+    return producers_ <= 0;
+  }
+
+  /**
+   * @brief Gets the amount of items held
+   * @return size_t - The amount of items
+   */
+  size_t size() {
+    GUARD(lock_);
+    return items_.size();
+  }
+};
+
+/**
+ * @brief Makes a channel to pass between stages
+ * @tparam T The type of the items
+ * @param capacity size_t - The max amount of items held
+ * @param producers int - The amount of producers that have to close it
+ * @return shared_ptr<channel<T>> - The channel
+ */
+template<typename T>
+std::shared_ptr<channel<T>> make_channel(size_t capacity, int producers = 1) {
+  return std::make_shared<channel<T>>(capacity, producers);
+}
+
+/**
+ * @brief Makes a task that feeds a channel until the generator says it's done, then closes it
+ * @param name string - The name of the task
+ * @param out channel - The channel to feed
+ * @param gen function - Sets the next item and returns true, or returns false when done
+ * @return task - The task, its result is the amount of items fed
+ */
+template<typename Out, typename F>
+task source(const std::string &name, std::shared_ptr<channel<Out>> out, F gen) {
+  return {name, [out, gen]() mutable {
+    uint64_t n = 0;
+    Out item;
+    while (gen(item) && out->push(std::move(item))) n++;
+    out->close();
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+/**
+ * @brief Makes a task that takes every item from one channel, and feeds what fn returns into another
+ *
+ * The task runs until its input closes, so it holds a worker for that long, the task manager needs at least as many
+ * workers as there are stages in a stream or it'll stall.
+ * @param name string - The name of the task
+ * @param in channel - The channel to take from
+ * @param out channel - The channel to feed
+ * @param fn function - Turns an In into an Out
+ * @return task - The task, its result is the amount of items passed on
+ */
+template<typename In, typename Out, typename F>
+task stage(const std::string &name, std::shared_ptr<channel<In>> in, std::shared_ptr<channel<Out>> out, F fn) {
+  return {name, [in, out, fn]() mutable {
+    uint64_t n = 0;
+    In item;
+    while (in->pop(item) && out->push(fn(std::move(item)))) n++;
+    out->close();
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+/**
+ * @brief Makes a task that takes every item from a channel and gives it to fn
+ * @param name string - The name of the task
+ * @param in channel - The channel to take from
+ * @param fn function - Takes an In
+ * @return task - The task, its result is the amount of items taken
+ */
+template<typename In, typename F>
+task sink(const std::string &name, std::shared_ptr<channel<In>> in, F fn) {
+  return {name, [in, fn]() mutable {
+    uint64_t n = 0;
+    In item;
+    while (in->pop(item)) {
+      fn(std::move(item));
+      n++;
+    }
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_CHANNEL_H_
+
+// ***************************
+// * Start of src/registry.h *
+// ***************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_REGISTRY_H_
+#define TASK_MANAGER_SRC_REGISTRY_H_
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace unmined {
+
+/**
+ * @brief The errors returned by tasks that are run from a type name
+ */
+enum task_errors {
+  /// The type of the task was never registered
+  UNKNOWN_TYPE = -100,
+  /// The process running the task died while running it
+  WORKER_DIED = -101,
+  /// No process could be started to run the task
+  SPAWN_FAILED = -102,
+};
+
+/**
+ * @brief A function that can be run from its serialized arguments
+ */
+using task_fn = std::function<retype(const std::string &args)>;
+
+/**
+ * @brief The registry of task types, so that a task can be described by a type name and its arguments
+ */
+class task_registry {
+ private:
+  /// The singleton instance
+  static inline task_registry *instance_ = nullptr;
+
+  /// The functions by type name
+  std::unordered_map<std::string, task_fn> types_;
+  std::mutex types_lock_;
+
+  task_registry() = default;
+
+ public:
+  /// you can't use this
+  task_registry(task_registry &other) = delete;
+  /// you can't use this
+  void operator=(const task_registry &) = delete;
+
+  /**
+   * @brief Gets the instance of the registry
+   * @return task_registry* - The registry instance
+   */
+  static task_registry *get_instance();
+
+  /**
+   * @brief Registers a task type, replacing any with the same name
+   * @param type string - The name of the type
+   * @param fn task_fn - The function run for the type
+   */
+  void add(const std::string &type, task_fn fn);
+
+  /**
+   * @brief Checks if a task type is registered
+   * @param type string - The name of the type
+   * @return bool - If the type is registered
+   */
+  bool has(const std::string &type);
+
+  /**
+   * @brief Gets a copy of every registered type
+   * @return unordered_map<string, task_fn> - The functions by type name
+   */
+  std::unordered_map<std::string, task_fn> types();
+
+  /**
+   * @brief Runs a task type with its arguments
+   * @param type string - The name of the type
+   * @param args string - The serialized arguments
+   * @return retype - The result, or UNKNOWN_TYPE if the type isn't registered
+   */
+  retype run(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Makes a task that runs a task type with its arguments
+   * @param name string - The name of the task
+   * @param type string - The name of the type
+   * @param args string - The serialized arguments
+   * @return task - The task, with default settings
+   */
+  task make(const std::string &name, const std::string &type, const std::string &args);
+};
+
+inline task_registry *task_registry::get_instance() {
+  static std::once_flag once;
+  std::call_once(once, []() { instance_ = new task_registry(); });
+  return instance_;
+}
+
+inline void task_registry::add(const std::string &type, task_fn fn) {
+  GUARD(types_lock_);
+  types_[type] = std::move(fn);
+}
+
+inline bool task_registry::has(const std::string &type) {
+  GUARD(types_lock_);
+  return types_.contains(type);
+}
+
+inline std::unordered_map<std::string, task_fn> task_registry::types() {
+  GUARD(types_lock_);
+  return types_;
+}
+
+inline retype task_registry::run(const std::string &type, const std::string &args) {
+  task_fn fn;
+  {
+    GUARD(types_lock_);
+    auto it = types_.find(type);
+    if (it == types_.end()) return {"", UNKNOWN_TYPE};
+    fn = it->second;
+  }
+  return fn(args);
+}
+
+inline task task_registry::make(const std::string &name, const std::string &type, const std::string &args) {
+  return {name, [this, type, args]() { return run(type, args); }};
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_REGISTRY_H_
+
+// **************************
+// * Start of src/journal.h *
+// **************************
+
+//
+// Created by christian on 10/19/26.
+//
+
+#ifndef TASK_MANAGER_SRC_JOURNAL_H_
+#define TASK_MANAGER_SRC_JOURNAL_H_
+
+#include <condition_variable>
+#include <memory>
+
+namespace unmined {
+
+/**
+ * @brief A task in the journal, described by its registered type and serialized arguments
+ */
+struct journal_entry {
+  uint64_t seq = 0;
+  std::string type;
+  std::string args;
+  std::string name;
+  std::string pool;
+  std::string after;
+};
+
+/**
+ * @brief An append only log of submitted and completed tasks, so the tasks that didn't finish can be run again after a
+ * crash
+ *
+ * Records are buffered, then written and fdatasync'd in one batch every commit interval (group commit), so adding
+ * doesn't wait on the disk, sync() does. Opening a journal replays the file through mmap to find the tasks that were
+ * submitted but never completed, dropping a torn record at the end. A file that doesn't start with the magic is left
+ * alone and the journal isn't good(). Once there are more completed tasks in the file than pending ones (and at least
+ * compact_after), it's rewritten with only the pending ones, without holding up submit and complete while it's written.
+ * Only the writer thread touches the file once it's open, compaction included.
+ *
+ * A batch that fails to write or sync is cut back off the file and retried on the next commit, sync() reports the
+ * failure.
+ *
+ * The file is the 8 byte magic "TMJNL001", then records of a 1 byte kind, a 4 byte length, the body and a 4 byte
+ * FNV-1a of the body. A submit's body is its sequence number and the 5 strings of the entry, each length prefixed,
+ * a complete's body is the sequence number.
+ */
+class journal {
+ private:
+  enum kinds : uint8_t {
+    SUBMIT = 1,
+    COMPLETE = 2,
+  };
+
+  static constexpr char MAGIC[8] = {'T', 'M', 'J', 'N', 'L', '0', '0', '1'};
+
+  std::string path_;
+  /// The file, only used by the writer thread once it's started
+  int fd_ = -1;
+  /// The bytes of whole records in the file
+  uint64_t size_ = 0;
+  /// How often buffered records are written and synced
+  std::chrono::milliseconds commit_interval_;
+  /// The least completed records in the file before it's compacted
+  uint64_t compact_after_;
+
+  /// The submitted tasks that haven't completed, by sequence number
+  std::map<uint64_t, journal_entry> live_;
+  /// The tasks found pending when the journal was opened
+  std::vector<journal_entry> recovered_;
+  /// The records not written yet
+  std::string buf_;
+  uint64_t next_seq_ = 0;
+  /// The records added so far
+  uint64_t appended_ = 0;
+  /// The records added so far that are on disk
+  uint64_t durable_ = 0;
+  /// The completed records in the file
+  uint64_t dead_ = 0;
+  uint64_t compactions_ = 0;
+  /// The amount of batches that failed to write or sync
+  uint64_t failures_ = 0;
+  /// The errno of the last failure, 0 once a batch is written again
+  int error_ = 0;
+  /// If compact was called and the writer hasn't compacted yet
+  bool compact_ = false;
+  bool stop_ = false;
+
+  std::thread writer_;
+  std::mutex lock_;
+  std::condition_variable wake_;
+  std::condition_variable durable_cv_;
+
+  static uint32_t _hash(const char *data, size_t len);
+  static void _put(std::string &out, const void *data, size_t len);
+  static void _put_string(std::string &out, const std::string &s);
+  static void _record(std::string &out, kinds kind, const std::string &body);
+  static std::string _submit_body(const journal_entry &e);
+  static bool _write_full(int fd, const char *data, size_t len);
+
+  /**
+   * @brief Reads the file into live_, and cuts off anything after the last whole record
+   */
+  void _replay();
+  /**
+   * @brief Writes and syncs buffered records every commit interval, and compacts the file
+   */
+  void _write();
+  /**
+   * @brief Rewrites the file with only the live tasks, on the writer thread
+   *
+   * The live tasks are copied under lock_ and written to a new file without it, then the records added meanwhile are
+   * appended under lock_ and the new file replaces the old one.
+   * @param guard unique_lock - The held lock_, unlocked while writing and held again on return
+   * @return bool - If the file was rewritten
+   */
+  bool _compact(std::unique_lock<std::mutex> &guard);
+
+ public:
+  /**
+   * @brief Opens a journal, replaying what's already in it
+   * @param path string - The path of the file, made if it doesn't exist
+   * @param commit_interval milliseconds - How often buffered records are written and synced, default 2ms
+   * @param compact_after uint64_t - The least completed records in the file before it's compacted, default 1M
+   */
+  explicit journal(const std::string &path,
+                   std::chrono::milliseconds commit_interval = std::chrono::milliseconds(2),
+                   uint64_t compact_after = 1'000'000);
+  /// writes what's buffered and closes the file
+  ~journal();
+
+  journal(journal &other) = delete;
+  void operator=(const journal &) = delete;
+
+  /**
+   * @brief Checks if the file opened
+   * @return bool - If records can be written
+   */
+  bool good() const;
+
+  /**
+   * @brief Adds a submitted task, it's on disk by the next commit
+   * @param e journal_entry - The task, its seq is set by the journal
+   * @return uint64_t - The sequence number of the task
+   */
+  uint64_t submit(journal_entry e);
+
+  /**
+   * @brief Adds that a task completed, so it won't be recovered
+   * @param seq uint64_t - The sequence number of the task
+   */
+  void complete(uint64_t seq);
+
+  /**
+   * @brief Waits until everything added so far is on disk
+   * @return bool - false if writing it failed, see error
+   */
+  bool sync();
+
+  /**
+   * @brief Rewrites the file with only the pending tasks now
+   * @return bool - If the file was rewritten
+   */
+  bool compact();
+
+  /**
+   * @brief Gets why the last batch failed to write or sync
+   * @return int - The errno, 0 if the last batch was written
+   */
+  int error();
+
+  /**
+   * @brief Gets the tasks that were pending when the journal was opened
+   * @return vector<journal_entry> - The tasks, in the order they were submitted
+   */
+  const std::vector<journal_entry> &recovered() const;
+
+  /**
+   * @brief Gets the amount of tasks submitted and not completed
+   * @return size_t - The amount of tasks
+   */
+  size_t pending();
+
+  /**
+   * @brief Gets how many times the file has been compacted
+   * @return uint64_t - The amount of compactions
+   */
+  uint64_t compactions();
+};
+
+inline journal::journal(const std::string &path, std::chrono::milliseconds commit_interval, uint64_t compact_after)
+    : path_(path), commit_interval_(commit_interval), compact_after_(compact_after) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) return;
+  _replay();
+  if (fd_ < 0) return;
+  for (auto &[seq, e]: live_) recovered_.push_back(e);
+  writer_ = std::thread(&journal::_write, this);
+}
+
+inline journal::~journal() {
+  if (!writer_.joinable()) return;
+  {
+    GUARD(lock_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  writer_.join();
+  if (fd_ >= 0) close(fd_);
+}
+
+inline bool journal::good() const {
+  return writer_.joinable();
+}
+
+inline uint32_t journal::_hash(const char *data, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t) data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+inline void journal::_put(std::string &out, const void *data, size_t len) {
+  out.append(static_cast<const char *>(data), len);
+}
+
+inline void journal::_put_string(std::string &out, const std::string &s) {
+  auto len = (uint32_t) s.size();
+  _put(out, &len, sizeof(len));
+  out += s;
+}
+
+inline void journal::_record(std::string &out, kinds kind, const std::string &body) {
+  auto len = (uint32_t) body.size();
+  uint32_t hash = _hash(body.data(), body.size());
+  _put(out, &kind, sizeof(kind));
+  _put(out, &len, sizeof(len));
+  out += body;
+  _put(out, &hash, sizeof(hash));
+}
+
+inline std::string journal::_submit_body(const journal_entry &e) {
+  std::string body;
+  _put(body, &e.seq, sizeof(e.seq));
+  _put_string(body, e.type);
+  _put_string(body, e.args);
+  _put_string(body, e.name);
+  _put_string(body, e.pool);
+  _put_string(body, e.after);
+  return body;
+}
+
+inline bool journal::_write_full(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n <= 0) return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline void journal::_replay() {
+  struct stat st{};
+  fstat(fd_, &st);
+  auto size = (size_t) st.st_size;
+  if (size < sizeof(MAGIC)) {
+    // new, or cut off before the magic was written, anything else isn't a journal
+    char head[sizeof(MAGIC)];
+    if (pread(fd_, head, size, 0) != (ssize_t) size || memcmp(head, MAGIC, size) != 0) {
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    if (ftruncate(fd_, 0) != 0 || !_write_full(fd_, MAGIC, sizeof(MAGIC)) || fdatasync(fd_) != 0) {
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    size_ = sizeof(MAGIC);
+    return;
+  }
+
+  void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (mem == MAP_FAILED) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  const char *data = static_cast<const char *>(mem);
+  if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+    munmap(mem, size);
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  size_t pos = sizeof(MAGIC);
+  madvise(mem, size, MADV_SEQUENTIAL);
+
+  auto take = [&](const char *&p, const char *end, void *out, size_t len) {
+    if ((size_t) (end - p) < len) return false;
+    memcpy(out, p, len);
+    p += len;
+    return true;
+  };
+  auto take_string = [&](const char *&p, const char *end, std::string &out) {
+    uint32_t len;
+    if (!take(p, end, &len, sizeof(len)) || (size_t) (end - p) < len) return false;
+    out.assign(p, len);
+    p += len;
+    return true;
+  };
+
+  while (pos + 9 <= size) {
+    uint8_t kind;
+    uint32_t len, hash;
+    memcpy(&kind, data + pos, 1);
+    memcpy(&len, data + pos + 1, 4);
+    if (pos + 9 + (size_t) len > size) break;
+    const char *body = data + pos + 5;
+    memcpy(&hash, body + len, 4);
+    if (hash != _hash(body, len)) break;
+
+    const char *p = body, *end = body + len;
+    journal_entry e;
+    if (!take(p, end, &e.seq, sizeof(e.seq))) break;
+    if (kind == SUBMIT) {
+      if (!take_string(p, end, e.type) || !take_string(p, end, e.args) || !take_string(p, end, e.name)
+          || !take_string(p, end, e.pool) || !take_string(p, end, e.after))
+        break;
+      live_[e.seq] = std::move(e);
+    } else if (kind == COMPLETE) {
+      live_.erase(e.seq);
+      dead_++;
+    } else {
+      break;
+    }
+    next_seq_ = std::max(next_seq_, e.seq + 1);
+    pos += 9 + len;
+  }
+  munmap(mem, size);
+
+  // a record torn by a crash is dropped, so new ones go after the last whole one
+  if (pos != size && ftruncate(fd_, (off_t) pos) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  size_ = pos;
+}
+
+inline void journal::_write() {
+  std::string batch;
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    wake_.wait_for(guard, commit_interval_, [this]() { return stop_ || compact_ || buf_.size() >= (1 << 20); });
+
+    if (!buf_.empty()) {
+      batch.swap(buf_);
+      uint64_t committing = appended_;
+      guard.unlock();
+      bool ok = _write_full(fd_, batch.data(), batch.size()) && fdatasync(fd_) == 0;
+      int err = ok ? 0 : errno;
+      // a partly written batch would leave a torn record that hides everything after it
+      if (!ok && ftruncate(fd_, (off_t) size_) != 0) {}
+      guard.lock();
+
+      if (ok) {
+        size_ += batch.size();
+        durable_ = std::max(durable_, committing);
+        error_ = 0;
+      } else {
+        batch += buf_;
+        buf_.swap(batch);
+        failures_++;
+        error_ = err;
+      }
+      batch.clear();
+      if (!ok) {
+        durable_cv_.notify_all();
+        if (stop_) return;
+        continue;
+      }
+    }
+
+    if (compact_ || (dead_ >= compact_after_ && dead_ > live_.size())) {
+      _compact(guard);
+      compact_ = false;
+    }
+    durable_cv_.notify_all();
+    if (stop_ && buf_.empty()) return;
+  }
+}
+
+inline bool journal::_compact(std::unique_lock<std::mutex> &guard) {
+  // what's buffered now is in live_, so only what's added after it goes after the live tasks
+  std::vector<journal_entry> live;
+  live.reserve(live_.size());
+  for (auto &[seq, e]: live_) live.push_back(e);
+  size_t skip = buf_.size();
+  uint64_t dead = dead_;
+  guard.unlock();
+
+  std::string tmp_path = path_ + ".compact";
+  int tmp = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  std::string out(MAGIC, sizeof(MAGIC));
+  uint64_t written = 0;
+  bool ok = tmp >= 0;
+  for (auto &e: live) {
+    _record(out, SUBMIT, _submit_body(e));
+    if (out.size() >= 1 << 20) {
+      ok = ok && _write_full(tmp, out.data(), out.size());
+      written += out.size();
+      out.clear();
+    }
+  }
+  ok = ok && _write_full(tmp, out.data(), out.size());
+  written += out.size();
+  ok = ok && fdatasync(tmp) == 0;
+  guard.lock();
+
+  ok = ok && _write_full(tmp, buf_.data() + skip, buf_.size() - skip) && fdatasync(tmp) == 0;
+  if (tmp >= 0) close(tmp);
+  if (!ok || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  written += buf_.size() - skip;
+
+  // the rename has to be on disk too, or a crash could bring the old file back
+  std::string dir = path_.find('/') == std::string::npos ? "." : path_.substr(0, path_.rfind('/') + 1);
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  close(fd_);
+  fd_ = open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+  size_ = written;
+  // everything buffered is in the new file, and only the completes added since the copy are
+  buf_.clear();
+  durable_ = appended_;
+  dead_ -= dead;
+  compactions_++;
+  return true;
+}
+
+inline uint64_t journal::submit(journal_entry e) {
+  GUARD(lock_);
+  e.seq = next_seq_++;
+  _record(buf_, SUBMIT, _submit_body(e));
+  appended_++;
+  uint64_t seq = e.seq;
+  live_[seq] = std::move(e);
+  return seq;
+}
+
+inline void journal::complete(uint64_t seq) {
+  std::string body;
+  _put(body, &seq, sizeof(seq));
+  GUARD(lock_);
+  _record(buf_, COMPLETE, body);
+  appended_++;
+  live_.erase(seq);
+  dead_++;
+}
+
+inline bool journal::sync() {
+  std::unique_lock<std::mutex> guard(lock_);
+  if (!writer_.joinable()) return false;
+  uint64_t target = appended_, failures = failures_;
+  wake_.notify_all();
+  durable_cv_.wait(guard, [&]() { return durable_ >= target || failures_ != failures; });
+  return durable_ >= target;
+}
+
+inline bool journal::compact() {
+  std::unique_lock<std::mutex> guard(lock_);
+  if (!writer_.joinable()) return false;
+  uint64_t compactions = compactions_, failures = failures_;
+  compact_ = true;
+  wake_.notify_all();
+  durable_cv_.wait(guard, [&]() { return !compact_ || failures_ != failures; });
+  return compactions_ != compactions;
+}
+
+inline int journal::error() {
+  GUARD(lock_);
+  return error_;
+}
+
+inline const std::vector<journal_entry> &journal::recovered() const {
+  return recovered_;
+}
+
+inline size_t journal::pending() {
+  GUARD(lock_);
+  return live_.size();
+}
+
+inline uint64_t journal::compactions() {
+  GUARD(lock_);
+  return compactions_;
+}
+
+/**
+ * @brief Adds a task described by a registered type and its arguments, journaling it first
+ * @param tm task_manager - The task manager to add it to
+ * @param j journal - The journal, which must outlive the task
+ * @param name string - The name of the task
+ * @param type string - The registered type of the task
+ * @param args string - The serialized arguments
+ * @param pool string - The pool the result goes to, defaults to the name
+ * @param after string - The task it's after
+ * @return uint64_t - The sequence number of the task in the journal
+ */
+template<int WORKER_COUNT, typename HOOKS>
+uint64_t add_journaled(task_manager<WORKER_COUNT, HOOKS> *tm,
+                       std::shared_ptr<journal> j,
+                       const std::string &name,
+                       const std::string &type,
+                       const std::string &args,
+                       const std::string &pool = "",
+                       const std::string &after = "") {
+  journal_entry e{0, type, args, name, pool.empty() ? name : pool, after};
+  uint64_t seq = j->submit(e);
+  task t{name,
+         [type, args]() { return task_registry::get_instance()->run(type, args); },
+         {
+             {AFTER, e.after},
+             {POOL, e.pool},
+         }};
+  // only once the result is stored, a crash before that has to run it again
+  t.finished = [j, seq](const retype &) { j->complete(seq); };
+  tm->add(std::move(t));
+  return seq;
+}
+
+/**
+ * @brief Adds back the tasks a journal found pending when it was opened
+ *
+ * Tasks they're after that aren't pending are marked as done, since they completed before the crash.
+ * @param tm task_manager - The task manager to add them to
+ * @param j journal - The journal, which must outlive the tasks
+ * @return size_t - The amount of tasks added back
+ */
+template<int WORKER_COUNT, typename HOOKS>
+size_t recover(task_manager<WORKER_COUNT, HOOKS> *tm, std::shared_ptr<journal> j) {
+  std::set<std::string> pending;
+  for (auto &e: j->recovered()) pending.insert(e.name);
+  for (auto &e: j->recovered()) {
+    if (!e.after.empty() && !pending.contains(e.after)) tm->mark_done(e.after);
+  }
+
+  for (auto &e: j->recovered()) {
+    uint64_t seq = e.seq;
+    std::string type = e.type, args = e.args;
+    task t{e.name,
+           [type, args]() { return task_registry::get_instance()->run(type, args); },
+           {
+               {AFTER, e.after},
+               {POOL, e.pool},
+           }};
+    t.finished = [j, seq](const retype &) { j->complete(seq); };
+    tm->add(std::move(t));
+  }
+  return j->recovered().size();
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_JOURNAL_H_
+
+// ***************************
+// * Start of src/pipeline.h *
+// ***************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_PIPELINE_H_
+#define TASK_MANAGER_SRC_PIPELINE_H_
+
+#include <memory>
+#include <string>
+
+namespace unmined {
+
+namespace detail {
+
+/**
+ * @brief Walks the stages of a pipeline at compile time, checking each can take what the one before returns
+ * @tparam In The type going into the first stage
+ * @tparam Stages The stages
+ */
+template<typename In, typename... Stages>
+struct chain {
+  static constexpr bool valid = true;
+  /// The index of the first stage that can't take its input, or the amount of stages if they all can
+  static constexpr size_t broken_at = 0;
+  using type = In;
+};
+
+template<typename In, typename S, typename... Rest>
+struct chain<In, S, Rest...> {
+  static constexpr bool step = std::is_invocable_v<S, In>;
+  using out = typename std::conditional_t<step, std::invoke_result<S, In>, std::type_identity<void>>::type;
+  using next = chain<out, Rest...>;
+
+  static constexpr bool valid = step && next::valid;
+  static constexpr size_t broken_at = step ? next::broken_at + 1 : 0;
+  using type = typename next::type;
+};
+
+/**
+ * @brief Turns what the last stage returns into a task result
+ */
+template<typename T>
+retype to_retype(T &&val) {
+  using V = std::remove_cvref_t<T>;
+  if constexpr (std::is_same_v<V, retype>) return std::forward<T>(val);
+  else if constexpr (std::is_convertible_v<T, std::string>) return {std::string(std::forward<T>(val)), 0};
+  else if constexpr (std::is_arithmetic_v<V>) return {std::to_string(val), 0};
+  else static_assert(sizeof(V) == 0, "the last stage of a pipeline must return retype, a string or a number");
+}
+
+}
+
+/**
+ * @brief A pipeline whose stages are known at compile time, e.g. pipeline<parse, transform, store>
+ *
+ * Each stage is a default constructible function object, and takes what the stage before it returns. The stages are
+ * checked when the pipeline is run, called directly so they can be inlined, and values are moved between them
+ * without going through retype.
+ * @tparam Stages The stages, in order
+ */
+template<typename... Stages>
+class pipeline {
+  static_assert(sizeof...(Stages) > 0, "a pipeline needs at least one stage");
+
+ private:
+  template<typename S, typename... Rest, typename In>
+  static constexpr decltype(auto) _run(In &&in) {
+    if constexpr (sizeof...(Rest) == 0) return S{}(std::forward<In>(in));
+    else return _run<Rest...>(S{}(std::forward<In>(in)));
+  }
+
+ public:
+  /// If the stages can be run in order starting from an In
+  template<typename In>
+  static constexpr bool accepts = detail::chain<In, Stages...>::valid;
+
+  /// The index of the first stage that can't take its input, when starting from an In
+  template<typename In>
+  static constexpr size_t broken_at = detail::chain<In, Stages...>::broken_at;
+
+  /// What the last stage returns, when starting from an In
+  template<typename In>
+  using result_t = typename detail::chain<In, Stages...>::type;
+
+  /**
+   * @brief Runs every stage on the calling thread
+   * @param in In - The input of the first stage
+   * @return result_t<In> - What the last stage returns
+   */
+  template<typename In>
+  static constexpr decltype(auto) run(In &&in) {
+    using c = detail::chain<In, Stages...>;
+    static_assert(c::valid, "a stage of the pipeline can't take what the stage before it returns, check broken_at<In>");
+    return _run<Stages...>(std::forward<In>(in));
+  }
+
+  /**
+   * @brief Makes a task that runs the whole pipeline on one worker
+   * @param name string - The name of the task
+   * @param in In - The input of the first stage
+   * @return task - The task, with default settings
+   */
+  template<typename In>
+  static task make_task(const std::string &name, In in) {
+    // shared so that move only inputs still fit in a std::function
+    auto held = std::make_shared<std::remove_cvref_t<In>>(std::move(in));
+    return {name, [held]() {
+      return detail::to_retype(run(std::move(*held)));
+    }};
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_PIPELINE_H_
+
+// *******************************
+// * Start of src/process_pool.h *
+// *******************************
+
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_PROCESS_POOL_H_
+#define TASK_MANAGER_SRC_PROCESS_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace unmined {
+
+/**
+ * @brief A pool of local worker processes that run registered task types, so a crash only takes down its worker
+ *
+ * Requests are written to each worker over a unix socket and can be pipelined, the worker runs them in order.
+ * Results are written straight into a ring of shared memory per worker, and only fall back to the socket when they
+ * don't fit. A worker that dies is respawned, the request it was running fails with WORKER_DIED and the ones queued
+ * behind it are sent to the new worker.
+ *
+ * Workers are forked, so task types have to be registered in the task_registry before the pool is made (or before
+ * the worker respawns) for them to exist in the worker.
+ */
+class process_pool {
+ private:
+  /// The start of each worker's shared memory
+  struct shm_header {
+    /// The total bytes of the ring the parent has read, written by the parent
+    alignas(64) std::atomic<uint64_t> consumed;
+    /// The request the worker is running, written by the worker
+    alignas(64) std::atomic<uint64_t> running;
+  };
+
+  /// The header of a request frame, followed by the type and the arguments
+  struct request_header {
+    uint64_t seq;
+    uint32_t type_len;
+    uint32_t args_len;
+  };
+
+  /// The header of a response frame, followed by the result if it isn't in shared memory
+  struct response_header {
+    uint64_t seq;
+    int32_t err;
+    uint32_t in_shm;
+    uint64_t offset;
+    uint64_t len;
+    /// How far the ring moved for this result
+    uint64_t advance;
+  };
+
+  struct request {
+    std::string type;
+    std::string args;
+    std::function<void(const retype &)> done;
+  };
+
+  struct worker {
+    pid_t pid = -1;
+    int fd = -1;
+    shm_header *shm = nullptr;
+    bool dead = false;
+    /// Held while writing to fd, so frames don't interleave
+    std::mutex write_lock;
+    /// The requests sent but not answered, by sequence number
+    std::map<uint64_t, std::shared_ptr<request>> pending;
+    /// The bytes read that don't make a full frame yet
+    std::string inbox;
+  };
+
+  /// The requests a respawned worker has to be sent again
+  struct resend_job {
+    std::shared_ptr<worker> to;
+    std::map<uint64_t, std::shared_ptr<request>> requests;
+  };
+
+  static constexpr uint64_t IDLE = ~0ull;
+
+  std::vector<std::shared_ptr<worker>> workers_;
+  /// The size of each worker's result ring
+  size_t ring_size_;
+  uint64_t next_seq_ = 0;
+  uint64_t respawns_ = 0;
+  bool stop_ = false;
+  /// A pipe to wake the reader when stopping
+  int wake_[2] = {-1, -1};
+  /// The thread reading results and watching for dead workers
+  std::thread reader_;
+  /// The resends waiting for the sender
+  std::deque<resend_job> resends_;
+  std::condition_variable resend_cv_;
+  /// The thread resending requests, so the reader keeps reading results while a resend waits on a full socket
+  std::thread sender_;
+  std::mutex lock_;
+
+  /**
+   * @brief Forks a new worker, must hold lock_ once the reader is running
+   * @return shared_ptr<worker> - The worker, or nullptr if it couldn't be started
+   */
+  std::shared_ptr<worker> _spawn();
+  /**
+   * @brief The loop a worker process runs until its socket closes
+   * @param fd int - The socket to the parent
+   * @param shm shm_header* - The worker's shared memory
+   * @param types unordered_map<string, task_fn> - The task types
+   */
+  void _serve(int fd, shm_header *shm, const std::unordered_map<std::string, task_fn> &types);
+  /**
+   * @brief Reads results from every worker, respawning the ones that die
+   */
+  void _read();
+  /**
+   * @brief Handles every full response frame in a worker's inbox
+   * @param w worker - The worker
+   */
+  void _handle(const std::shared_ptr<worker> &w);
+  /**
+   * @brief Replaces a dead worker and sends it the requests the old one hadn't started
+   *
+   * If no new worker can be started, the dead one is dropped and its requests fail with SPAWN_FAILED.
+   * @param old worker - The dead worker
+   */
+  void _respawn(const std::shared_ptr<worker> &old);
+  /**
+   * @brief Sends the requests in resends_ until stopped
+   */
+  void _resend();
+  /**
+   * @brief Writes a request to a worker, if it's still alive
+   */
+  void _send(const std::shared_ptr<worker> &w, uint64_t seq, const request &req);
+
+  static bool _read_full(int fd, void *buf, size_t len);
+  static bool _write_full(int fd, const void *buf, size_t len);
+  static void _free(const std::shared_ptr<worker> &w, size_t ring_size);
+
+ public:
+  /**
+   * @brief Makes a pool of worker processes
+   * @param workers int - The amount of worker processes
+   * @param ring_size size_t - The bytes of shared memory each worker writes results into
+   */
+  explicit process_pool(int workers, size_t ring_size = 1 << 20);
+  /// stops and reaps every worker, failing what they didn't finish
+  ~process_pool();
+
+  process_pool(process_pool &other) = delete;
+  void operator=(const process_pool &) = delete;
+
+  /**
+   * @brief Sends a task to the least busy worker
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @param done function - Called from the reader thread with the result
+   */
+  void submit(const std::string &type, const std::string &args, std::function<void(const retype &)> done);
+
+  /**
+   * @brief Sends a task to the least busy worker
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @return future<retype> - The result
+   */
+  std::future<retype> submit(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Makes a task function that runs on this pool, for use with task_manager::add
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @return function<retype()> - The function, which waits for the result in a blocking_region
+   */
+  std::function<retype()> remote(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Gets how many times a worker has been respawned
+   * @return uint64_t - The amount of respawns
+   */
+  uint64_t respawns();
+
+  /**
+   * @brief Gets the process IDs of the workers
+   * @return vector<pid_t> - The process IDs
+   */
+  std::vector<pid_t> pids();
+};
+
+inline process_pool::process_pool(int workers, size_t ring_size) : ring_size_(ring_size) {
+  if (pipe(wake_) != 0) wake_[0] = wake_[1] = -1;
+  for (int i = 0; i < workers; ++i) {
+    if (auto w = _spawn()) workers_.push_back(w);
+  }
+  reader_ = std::thread(&process_pool::_read, this);
+  sender_ = std::thread(&process_pool::_resend, this);
+}
+
+inline process_pool::~process_pool() {
+  {
+    GUARD(lock_);
+    stop_ = true;
+  }
+  resend_cv_.notify_all();
+  char c = 0;
+  if (write(wake_[1], &c, 1) < 0) {}
+  reader_.join();
+  close(wake_[0]);
+  close(wake_[1]);
+
+  // first, so a resend stuck on a full socket fails and the sender can stop
+  for (auto &w: workers_) {
+    if (w->pid > 0) kill(w->pid, SIGKILL);
+  }
+  sender_.join();
+
+  for (auto &w: workers_) {
+    {
+      GUARD(w->write_lock);
+      w->dead = true;
+      if (w->fd >= 0) close(w->fd);
+      w->fd = -1;
+    }
+    if (w->pid > 0) waitpid(w->pid, nullptr, 0);
+    for (auto &[seq, req]: w->pending) req->done({"", WORKER_DIED});
+    _free(w, ring_size_);
+  }
+}
+
+inline std::shared_ptr<process_pool::worker> process_pool::_spawn() {
+  auto w = std::make_shared<worker>();
+  void *mem = mmap(nullptr, sizeof(shm_header) + ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  w->shm = new(mem) shm_header();
+  w->shm->running = IDLE;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    _free(w, ring_size_);
+    return nullptr;
+  }
+  // copied before forking, the registry's lock may be held by another thread
+  auto types = task_registry::get_instance()->types();
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    _free(w, ring_size_);
+    return nullptr;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    close(wake_[0]);
+    close(wake_[1]);
+    // the sockets of the other workers, or they would never see their parent close them
+    for (auto &other: workers_) {
+      if (!other->dead && other->fd >= 0) close(other->fd);
+    }
+    _serve(fds[1], w->shm, types);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  w->pid = pid;
+  w->fd = fds[0];
+  return w;
+}
+
+inline void process_pool::_serve(int fd, shm_header *shm, const std::unordered_map<std::string, task_fn> &types) {
+  char *ring = reinterpret_cast<char *>(shm + 1);
+  uint64_t produced = 0;
+  request_header in{};
+  std::string type, args;
+
+  while (_read_full(fd, &in, sizeof(in))) {
+    type.resize(in.type_len);
+    args.resize(in.args_len);
+    if (!_read_full(fd, type.data(), type.size()) || !_read_full(fd, args.data(), args.size())) break;
+
+    shm->running.store(in.seq, std::memory_order_release);
+    auto it = types.find(type);
+    retype result = it == types.end() ? retype{"", UNKNOWN_TYPE} : it->second(args);
+
+    response_header out{in.seq, result.err, 0, 0, result.ret.size(), 0};
+    uint64_t pos = produced % ring_size_;
+    uint64_t advance = pos + out.len > ring_size_ ? ring_size_ - pos + out.len : out.len;
+    if (out.len > 0 && produced + advance - shm->consumed.load(std::memory_order_acquire) <= ring_size_) {
+      out.in_shm = 1;
+      out.offset = pos + out.len > ring_size_ ? 0 : pos;
+      out.advance = advance;
+      memcpy(ring + out.offset, result.ret.data(), out.len);
+      produced += advance;
+    }
+
+    shm->running.store(IDLE, std::memory_order_release);
+    if (!_write_full(fd, &out, sizeof(out))) break;
+    if (!out.in_shm && !_write_full(fd, result.ret.data(), out.len)) break;
+  }
+  close(fd);
+}
+
+inline void process_pool::_read() {
+  std::vector<pollfd> fds;
+  std::vector<std::shared_ptr<worker>> ws;
+  char buf[1 << 16];
+
+  while (true) {
+    {
+      GUARD(lock_);
+      if (stop_) return;
+      ws = workers_;
+    }
+    fds.clear();
+    for (auto &w: ws) fds.push_back({w->fd, POLLIN, 0});
+    fds.push_back({wake_[0], POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+    for (size_t i = 0; i < ws.size(); ++i) {
+      if (!fds[i].revents) continue;
+      ssize_t n = recv(ws[i]->fd, buf, sizeof(buf), 0);
+      if (n > 0) {
+        ws[i]->inbox.append(buf, n);
+        _handle(ws[i]);
+      } else if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      } else {
+        _respawn(ws[i]);
+      }
+    }
+  }
+}
+
+inline void process_pool::_handle(const std::shared_ptr<worker> &w) {
+  char *ring = reinterpret_cast<char *>(w->shm + 1);
+  while (w->inbox.size() >= sizeof(response_header)) {
+    response_header h{};
+    memcpy(&h, w->inbox.data(), sizeof(h));
+    size_t frame = sizeof(h) + (h.in_shm ? 0 : h.len);
+    if (w->inbox.size() < frame) return;
+
+    retype result{"", h.err};
+    if (h.in_shm) {
+      result.ret.assign(ring + h.offset, h.len);
+      w->shm->consumed.fetch_add(h.advance, std::memory_order_release);
+    } else {
+      result.ret.assign(w->inbox.data() + sizeof(h), h.len);
+    }
+    w->inbox.erase(0, frame);
+
+    std::shared_ptr<request> req;
+    {
+      GUARD(lock_);
+      auto it = w->pending.find(h.seq);
+      if (it == w->pending.end()) continue;
+      req = it->second;
+      w->pending.erase(it);
+    }
+    req->done(result);
+  }
+}
+
+inline void process_pool::_respawn(const std::shared_ptr<worker> &old) {
+  {
+    GUARD(old->write_lock);
+    old->dead = true;
+    close(old->fd);
+    old->fd = -1;
+  }
+  waitpid(old->pid, nullptr, 0);
+  old->pid = -1;
+  uint64_t crashed = old->shm->running.load(std::memory_order_acquire);
+
+  std::shared_ptr<worker> fresh;
+  std::shared_ptr<request> failed;
+  // taken with the move, a submit to the fresh worker after it sends its own request
+  std::map<uint64_t, std::shared_ptr<request>> resend;
+  bool stopping;
+  {
+    GUARD(lock_);
+    stopping = stop_;
+    if (stopping) {
+      // the destructor skips a worker that's already closed and reaped, so what it had fails here
+      resend.swap(old->pending);
+    } else {
+      auto it = std::find(workers_.begin(), workers_.end(), old);
+      fresh = _spawn();
+      if (fresh) {
+        *it = fresh;
+        respawns_++;
+      } else {
+        workers_.erase(it);
+      }
+      for (auto &[seq, req]: old->pending) {
+        if (seq == crashed) failed = req;
+        else resend[seq] = req;
+      }
+      old->pending.clear();
+      if (fresh) fresh->pending = resend;
+    }
+  }
+  if (stopping) {
+    for (auto &[seq, req]: resend) req->done({"", WORKER_DIED});
+    return;
+  }
+
+  _free(old, ring_size_);
+
+  if (failed) failed->done({"", WORKER_DIED});
+  if (!fresh) {
+    for (auto &[seq, req]: resend) req->done({"", SPAWN_FAILED});
+    return;
+  }
+  {
+    GUARD(lock_);
+    resends_.push_back({fresh, std::move(resend)});
+  }
+  resend_cv_.notify_one();
+}
+
+inline void process_pool::_resend() {
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    resend_cv_.wait(guard, [this]() { return stop_ || !resends_.empty(); });
+    if (stop_) return;
+    resend_job job = std::move(resends_.front());
+    resends_.pop_front();
+    guard.unlock();
+    for (auto &[seq, req]: job.requests) _send(job.to, seq, *req);
+    guard.lock();
+  }
+}
+
+inline void process_pool::_send(const std::shared_ptr<worker> &w, uint64_t seq, const request &req) {
+  std::string frame(sizeof(request_header), '\0');
+  request_header h{seq, (uint32_t) req.type.size(), (uint32_t) req.args.size()};
+  memcpy(frame.data(), &h, sizeof(h));
+  frame += req.type;
+  frame += req.args;
+
+  GUARD(w->write_lock);
+  // if the worker died, the reader hands this request to its replacement
+  if (w->dead) return;
+  _write_full(w->fd, frame.data(), frame.size());
+}
+
+inline bool process_pool::_read_full(int fd, void *buf, size_t len) {
+  char *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline bool process_pool::_write_full(int fd, const void *buf, size_t len) {
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline void process_pool::_free(const std::shared_ptr<worker> &w, size_t ring_size) {
+  w->shm->~shm_header();
+  munmap(w->shm, sizeof(shm_header) + ring_size);
+  w->shm = nullptr;
+}
+
+inline void process_pool::submit(const std::string &type,
+                                 const std::string &args,
+                                 std::function<void(const retype &)> done) {
+  auto req = std::make_shared<request>(request{type, args, std::move(done)});
+  std::shared_ptr<worker> w;
+  uint64_t seq;
+  {
+    GUARD(lock_);
+    if (workers_.empty()) {
+      req->done({"", SPAWN_FAILED});
+      return;
+    }
+    w = *std::min_element(workers_.begin(), workers_.end(), [](const auto &a, const auto &b) {
+      return a->pending.size() < b->pending.size();
+    });
+    seq = next_seq_++;
+    w->pending[seq] = req;
+  }
+  _send(w, seq, *req);
+}
+
+inline std::future<retype> process_pool::submit(const std::string &type, const std::string &args) {
+  auto promise = std::make_shared<std::promise<retype>>();
+  auto future = promise->get_future();
+  submit(type, args, [promise](const retype &r) { promise->set_value(r); });
+  return future;
+}
+
+inline std::function<retype()> process_pool::remote(const std::string &type, const std::string &args) {
+  return [this, type, args]() {
+    auto result = submit(type, args);
+    // the worker only waits here, so the task manager can start another while compensating
+    blocking_region blocking;
+    return result.get();
+  };
+}
+
+inline uint64_t process_pool::respawns() {
+  GUARD(lock_);
+  return respawns_;
+}
+
+inline std::vector<pid_t> process_pool::pids() {
+  std::vector<pid_t> out;
+  GUARD(lock_);
+  for (auto &w: workers_) out.push_back(w->pid);
+  return out;
+}
 
- private:
-  /// makes a new task manager, do not use this
-  task_manager();
-  /// deletes the task manager safely
-  ~task_manager();
+}
 
-  /**
-   * @brief The run function that starts all the workers and main thread
-   */
-  void _run();
-  /**
-   * @brief Starts a worker with an ID
-   * @param id int - The ID of the worker
-   */
-  void _run_worker(int id);
+#endif //TASK_MANAGER_SRC_PROCESS_POOL_H_
 
-  /**
-   * @brief Gets the first item in the queue, and removes it
-   * @return task - The first item in the queue
-   */
-  task _pop_queue();
+// *************************
+// * Start of src/replay.h *
+// *************************
 
- public:
-  /// you can't use this
-  task_manager(task_manager &other) = delete;
-  /// you can't use this
-  void operator=(const task_manager &) = delete;
+//
+// Created by christian on 10/19/26.
+//
 
-  /**
-   * @brief Gets the instance of the task manager
-   * @return task_manager* - The task manager instance
-   */
-  static task_manager *get_instance();
+#ifndef TASK_MANAGER_SRC_REPLAY_H_
+#define TASK_MANAGER_SRC_REPLAY_H_
 
-  /**
-   * @brief Adds a task to the queue of tasks to be done
-   * @param task task - The task to be done, will be last in the order
-   */
-  void add(task task);
+#include <algorithm>
+#include <set>
 
-  /**
-   * @brief Starts fulfilling tasks
-   */
-  void start();
-  /**
-   * @brief Pauses fulfilling tasks
-   */
-  void pause();
-  /**
-   * @brief Stops the task manager and cleans it up
-   */
-  void stop();
-  /**
-   * @brief Checks if the the queue is empty
-   * @return bool - If the queue is empty
-   */
-  bool is_done();
+namespace unmined {
 
-  /**
-   * @brief Joins the main task manager thread, which will wait until all tasks are complete
-   */
-  void join();
+/**
+ * @brief The outcome of replay
+ */
+struct replay_report {
+  /// The tasks re-submitted
+  uint64_t tasks = 0;
+  /// The wall time from the first submit to the last task finishing
+  std::chrono::nanoseconds makespan{0};
+  /// The pools seen in the capture
+  std::vector<std::string> pools;
+};
 
-  /**
-   * @brief Returns a vector of task names
-   * @return vector<string> - vector of task names
-   */
-  std::vector<std::string> tasks();
+/**
+ * @brief Makes a task that stands in for a captured one, using the same CPU time, then waiting out the rest of its wall
+ * time, and returning a result of the same size
+ * @param r capture_record - The captured task
+ * @param speed double - How many times faster than captured to run
+ * @return task - The task, with the captured name, POOL and AFTER
+ */
+inline task synthetic_task(const capture_record &r, double speed) {
+  auto cpu = std::chrono::nanoseconds((int64_t) ((double) r.cpu / speed));
+  auto wall = std::chrono::nanoseconds((int64_t) ((double) r.runtime / speed));
+  uint64_t size = r.result_size;
+  return {r.name,
+          [cpu, wall, size]() {
+            auto start = std::chrono::steady_clock::now();
+            timespec now{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            auto until = std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec) + cpu;
+            do {
+              clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            } while (std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec) < until);
+            std::this_thread::sleep_until(start + wall);
+            return retype{std::string(size, 'x'), 0};
+          },
+          {
+              {AFTER, r.after},
+              {POOL, r.pool},
+          }};
+}
 
-  /**
-   * @brief Sets a setting
-   * @param t tm_settings - The setting to set
-   * @param val bool - The value of the setting
-   */
-  void set(tm_settings t, bool val) {
-    GUARD(settings_lock_);
-    if (val) SET_ON(settings_, t);
-    else
-      SET_OFF(settings_, ~t);
+/**
+ * @brief Re-submits a captured workload as synthetic tasks with the same timing, pools and AFTER dependencies
+ *
+ * This uses up the task_manager<WORKER_COUNT, HOOKS> instance, it's started, and joined once everything has run.
+ * Turn on TRACK_USAGE first to get the queue waits and usage of each pool afterwards. Tasks the records are after that
+ * aren't in them are marked as done.
+ * @tparam WORKER_COUNT The amount of workers to replay with
+ * @param tm task_manager - The task manager to replay on
+ * @param records vector<capture_record> - The captured tasks, see read_capture
+ * @param speed double - How many times faster than captured to submit and run, default 1
+ * @return replay_report - How long it took
+ */
+template<int WORKER_COUNT, typename HOOKS>
+replay_report replay(task_manager<WORKER_COUNT, HOOKS> *tm, std::vector<capture_record> records, double speed = 1) {
+  replay_report report;
+  if (speed <= 0) speed = 1;
+  std::stable_sort(records.begin(), records.end(), [](const capture_record &a, const capture_record &b) {
+    return a.submitted < b.submitted;
+  });
+
+  // a capture started mid run has tasks after ones that ran before it, those count as done or they'd never run
+  std::set<std::string> names;
+  for (auto &r: records) names.insert(r.name);
+  for (auto &r: records) {
+    if (!r.after.empty() && !names.contains(r.after)) tm->mark_done(r.after);
   }
 
-  /**
-   * @brief Gets the current value of a setting
-   * @param mask tm_settings - The setting(s) to get
-   * @return bool - The value of the setting (true or false)
-   */
-  bool get(tm_settings mask) {
-    return EVAL(settings_, mask);
+  std::set<std::string> pools;
+  int64_t first = records.empty() ? 0 : records.front().submitted;
+  auto start = std::chrono::steady_clock::now();
+  tm->set(KILL_ON_EMPTY, false);
+  tm->start();
+  for (auto &r: records) {
+    std::this_thread::sleep_until(start + std::chrono::nanoseconds((int64_t) ((double) (r.submitted - first) / speed)));
+    tm->add(synthetic_task(r, speed));
+    pools.insert(r.pool);
+    report.tasks++;
   }
+  // only now, or the workers would stop whenever they caught up with the submits
+  tm->set(KILL_ON_EMPTY, true);
+  tm->join();
 
-  void clear_pool(const std::string &pool);
-  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools();
-  std::unordered_map<int, std::string> pool(const std::string& name);
-
-};
+  report.makespan = std::chrono::steady_clock::now() - start;
+  report.pools.assign(pools.begin(), pools.end());
+  return report;
+}
 
 }
 
-#endif //TASK_MANAGER__TASK_MANAGER_H_
+#endif //TASK_MANAGER_SRC_REPLAY_H_
 
 // ***********************
 // * Start of src/util.h *
@@ -287,6 +3005,8 @@ inline std::string to_string(std::deque<T> q);
 
 inline std::string to_string(const std::vector<std::string> &q);
 
+inline unmined::thread_usage usage();
+
 /**
  * @brief Checks if an array has a certain element
  * @tparam T The type of the array
@@ -342,6 +3062,25 @@ inline std::string to_string(const std::vector<std::string> &q) {
   return out;
 }
 
+/**
+ * @brief Samples the time and context switches used by the calling thread
+ * @return thread_usage - The usage so far, wall time is from an arbitrary start
+ */
+inline unmined::thread_usage usage() {
+  unmined::thread_usage out;
+  out.wall = std::chrono::steady_clock::now().time_since_epoch();
+
+  timespec cpu{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  out.cpu = std::chrono::seconds(cpu.tv_sec) + std::chrono::nanoseconds(cpu.tv_nsec);
+
+  rusage ru{};
+  getrusage(RUSAGE_THREAD, &ru);
+  out.voluntary_switches = ru.ru_nvcsw;
+  out.involuntary_switches = ru.ru_nivcsw;
+  return out;
+}
+
 }
 
 #endif //TASK_MANAGER_SRC_UTIL_H_
@@ -356,26 +3095,31 @@ inline std::string to_string(const std::vector<std::string> &q) {
 
 #include <thread>
 #include <iostream>
+#include <future>
+#include <set>
 
 using millis = std::chrono::milliseconds;
 using namespace std::chrono_literals;
 
 // region singleton stuff
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT> *unmined::task_manager<WORKER_COUNT>::instance_ = nullptr;
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS> *unmined::task_manager<WORKER_COUNT, HOOKS>::instance_ = nullptr;
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT>::task_manager() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS>::task_manager() {
   main_thread_ = std::thread(&task_manager::_run, this);
 }
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT>::~task_manager() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS>::~task_manager() {
   pause();
-  GUARD(queue_lock_);
-  while (!queue_.empty()) {
-    queue_.pop_front();
+  {
+    GUARD(queue_lock_);
+    queue_.clear();
+    active_.clear();
+    for (auto &l: local_) l.clear();
+    queued_ = 0;
   }
   stop();
 }
@@ -386,125 +3130,675 @@ unmined::task_manager<WORKER_COUNT>::~task_manager() {
  * @brief Runs the set amount of workers
  * @tparam WORKER_COUNT The amount of workers the task manager allows
  */
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::_run() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_run() {
+  live_ = WORKER_COUNT;
   for (int i = 0; i < WORKER_COUNT; ++i) {
+    states_[i].running = true;
     workers_[i] = std::thread(&task_manager::_run_worker, this, i);
   }
-  for (int i = 0; i < WORKER_COUNT; ++i) {
-    workers_[i].join();
+  while (live_ > 0) {
+    // only the workers ending needs noticing without compensation
+    std::this_thread::sleep_for(_monitor() ? 1ms : 10ms);
+  }
+  for (int i = 0; i < MAX_WORKERS; ++i) {
+    if (workers_[i].joinable()) workers_[i].join();
   }
+  // nothing else will be streamed, so readers can finish
+  GUARD(sink_lock_);
+  if (stream_) stream_->close();
 }
 
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::_run_worker(int id) {
-  worker_start_callback(id);
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_monitor() {
+  GUARD(compensation_lock_);
+  if (compensation_cap_ == 0) {
+    compensation_target_ = 0;
+    return false;
+  }
+
+  int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+  int64_t threshold = std::chrono::nanoseconds(block_threshold_).count();
+  int blocked = 0;
+  for (int i = 0; i < MAX_WORKERS; ++i) {
+    if (i >= WORKER_COUNT && !states_[i].running) continue;
+    int64_t since = states_[i].busy_since.load(std::memory_order_relaxed);
+    if (states_[i].blocking.load(std::memory_order_relaxed) > 0
+        || (threshold > 0 && since != 0 && now - since > threshold))
+      blocked++;
+  }
+  compensation_target_ = std::min(blocked, compensation_cap_);
+
+  bool waiting;
+  {
+    GUARD(queue_lock_);
+    waiting = queued_ > 0;
+  }
+  if (!waiting || util::get(stop_, kill_lock_)) return true;
+
+  for (int i = WORKER_COUNT; i < MAX_WORKERS && compensating_ < compensation_target_; ++i) {
+    if (states_[i].running) continue;
+    // a retired compensation worker that hasn't been joined yet
+    if (workers_[i].joinable()) workers_[i].join();
+    states_[i].running = true;
+    compensating_++;
+    compensation_stats_.spawned++;
+    compensation_stats_.peak = std::max(compensation_stats_.peak, (uint64_t) compensating_);
+    workers_[i] = std::thread(&task_manager::_run_worker, this, i);
+  }
+  return true;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_retire() {
+  GUARD(compensation_lock_);
+  if (compensating_ <= compensation_target_) return false;
+  compensating_--;
+  compensation_stats_.retired++;
+  return true;
+}
 
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_run_worker(int id) {
+  detail::current_worker = id;
+  detail::current_blocking = &states_[id].blocking;
+  HOOK(on_worker_start, id);
+
+  bool retired = false;
+  // set when a task wasn't ready, so a worker doesn't keep taking it back off its own queue
+  bool skip_local = false;
   while (!util::get(stop_, kill_lock_)) {
+    if (id >= WORKER_COUNT && (retired = _retire())) break;
     if (util::get(is_paused_, is_paused_lock_)) continue;
-    struct task task = _pop_queue();
+    struct task task = _pop_queue(id, skip_local);
     if (!task.func) {
-      if (get(KILL_ON_EMPTY)) break;
+      // tasks may be left on other workers' queues that this one can't steal yet
+      if (get(KILL_ON_EMPTY) && is_done()) break;
       continue;
     }
 
-    std::string after = task.settings[AFTER];
-    if (!after.empty()) {
-      if (!util::has(util::get(done_, done_lock_), after)) {
+    skip_local = !_ready(task);
+    if (skip_local) continue;
+    if (get(TRACK_USAGE)) {
+      GUARD(stats_lock_);
+      waits_[task.settings[POOL]].add(std::chrono::steady_clock::now() - task.queued);
+    }
+    states_[id].busy_since.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    retype result = _start(task, id);
+    states_[id].busy_since.store(0, std::memory_order_relaxed);
+    _complete(task, result, id);
+  }
+  HOOK(on_worker_stop, id);
+  detail::storage.clear();
+  detail::current_worker = -1;
+  detail::current_blocking = nullptr;
+  if (id < WORKER_COUNT) {
+    states_[id].running = false;
+    live_--;
+    return;
+  }
+  GUARD(compensation_lock_);
+  if (!retired) {
+    compensating_--;
+    compensation_stats_.retired++;
+  }
+  states_[id].running = false;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_ready(task &task) {
+  std::string after = task.settings[AFTER];
+  if (after.empty()) return true;
+  {
+    GUARD(done_lock_);
+    auto it = done_.find(after);
+    if (it != done_.end()) {
+      auto ref = refs_.find(after);
+      if (ref != refs_.end() && --ref->second == 0) {
+        refs_.erase(ref);
+        // it was only kept for this task
+        if (it->second == 0) done_.erase(it);
+      }
+      return true;
+    }
+  }
+  _push(task); // TODO: rework this, its garbo
+  return false;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_done(const std::string &name) {
+  done_[name]++;
+  if (done_limit_ == 0) return;
+  done_order_.push_back(name);
+  while (done_order_.size() > done_limit_) {
+    auto it = done_.find(done_order_.front());
+    done_order_.pop_front();
+    if (--it->second == 0 && !refs_.contains(it->first)) done_.erase(it);
+  }
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::retype unmined::task_manager<WORKER_COUNT, HOOKS>::_start(task &task, int id) {
+  HOOK(on_task_start, task, id);
+  bool track = get(TRACK_USAGE);
+  bool capturing = capturing_.load(std::memory_order_relaxed);
+  thread_usage before;
+  if (track || capturing) before = util::usage();
+  retype result = task.func();
+  if (track || capturing) {
+    thread_usage after = util::usage();
+    if (track) {
+      GUARD(stats_lock_);
+      pool_stats_[task.settings[POOL]].add(before, after);
+      worker_stats_[id].add(before, after);
+    }
+    if (capturing) _capture(task, result, after.wall - before.wall, after.cpu - before.cpu);
+  }
+  if (result.err < 0) HOOK(on_task_fail, task, id, result.err);
+  return result;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_complete(task &task, const retype &result, int id) {
+  std::vector<struct task> attached;
+  std::string key = task.settings[KEY];
+  if (!key.empty()) {
+    GUARD(keys_lock_);
+    attached = std::move(in_flight_[key]);
+    in_flight_.erase(key);
+    if (result.err >= 0) results_.put(key, result);
+  }
+  _finish(task, result);
+  HOOK(on_task_stop, task, id);
+  // the tasks that joined the key finish with its result, as if they had run it
+  for (auto &t: attached) {
+    _capture(t, result);
+    _finish(t, result);
+    if (result.err < 0) HOOK(on_task_fail, t, id, result.err);
+    HOOK(on_task_stop, t, id);
+  }
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_capture(task &task,
+                                                          const retype &result,
+                                                          std::chrono::nanoseconds wall,
+                                                          std::chrono::nanoseconds cpu) {
+  if (!capturing_.load(std::memory_order_relaxed)) return;
+  GUARD(capture_lock_);
+  if (!capture_) return;
+  capture_->write({std::chrono::duration_cast<std::chrono::nanoseconds>(task.queued - capture_start_).count(),
+                   (uint64_t) wall.count(),
+                   (uint64_t) cpu.count(),
+                   result.ret.size(),
+                   task.name,
+                   task.settings[POOL],
+                   task.settings[AFTER]});
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::sim_report unmined::task_manager<WORKER_COUNT, HOOKS>::simulate(uint64_t seed,
+                                                                          std::function<std::chrono::nanoseconds(const task &)> cost) {
+  using nanos = std::chrono::nanoseconds;
+  struct running {
+    nanos end;
+    uint64_t tiebreak;
+    int wid;
+    struct task task;
+    retype result;
+    nanos start;
+  };
+  auto later = [](const running &a, const running &b) {
+    return a.end != b.end ? a.end > b.end : a.tiebreak > b.tiebreak;
+  };
+
+  pause();
+  {
+    GUARD(queue_lock_);
+    simulating_ = true;
+  }
+  std::mt19937_64 rng(seed);
+  std::priority_queue<running, std::vector<running>, decltype(later)> events(later);
+  std::array<bool, WORKER_COUNT> busy{};
+  // the worker_local values of each virtual worker, since they all run on this thread
+  std::array<detail::local_storage, WORKER_COUNT> storages;
+  std::array<int, WORKER_COUNT> order{};
+  for (int i = 0; i < WORKER_COUNT; ++i) order[i] = i;
+  sim_report report;
+
+  while (true) {
+    // every idle worker tries to take a task at this instant, in an order picked by the seed
+    std::shuffle(order.begin(), order.end(), rng);
+    // the tasks found not ready at this instant, by pool and ID
+    std::set<std::pair<std::string, int>> not_ready;
+    for (int wid: order) {
+      if (busy[wid]) continue;
+      bool skip_local = false;
+      while (true) {
+        size_t queued;
         {
           GUARD(queue_lock_);
-          queue_.push_back(task); // TODO: rework this, its garbo
+          queued = queued_;
         }
-        continue;
+        if (queued == 0 || not_ready.size() >= queued) break;
+        struct task task = _pop_queue(wid, skip_local);
+        if (!task.func) break;
+        if (!_ready(task)) {
+          report.requeues++;
+          // a task this worker already tried means it has nothing new to try
+          if (!not_ready.insert({task.settings[POOL], task.id}).second) break;
+          skip_local = true;
+          continue;
+        }
+        nanos took = cost ? cost(task) : task.settings[COST].empty() ? nanos(1ms) : nanos(std::stoll(task.settings[COST]));
+        detail::current_worker = wid;
+        detail::storage_override = &storages[wid];
+        retype result = _start(task, wid);
+        detail::storage_override = nullptr;
+        detail::current_worker = -1;
+        events.push({report.makespan + took, rng(), wid, task, result, report.makespan});
+        busy[wid] = true;
+        break;
       }
     }
 
-    task_start_callback(task, id);
-    auto [val, err] = task.func();
-    if (err < 0) task_fail_callback(task, id, err);
-    {
-      GUARD(done_lock_);
-      done_.push_back(task.name);
-    }
-    {
-      GUARD(pools_lock_);
-      pools_[task.settings[POOL]][task.id] = val;
-    }
-    task_stop_callback(task, id);
+    if (events.empty()) break;
+    // then the clock jumps to the next task to finish
+    running next = events.top();
+    events.pop();
+    report.makespan = next.end;
+    _complete(next.task, next.result, next.wid);
+    busy[next.wid] = false;
+    report.tasks++;
+    report.trace.push_back({next.task.name, next.wid, next.start, next.end});
   }
-  worker_stop_callback(id);
+
+  GUARD(queue_lock_);
+  simulating_ = false;
+  report.stuck = queued_;
+  return report;
 }
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT> *unmined::task_manager<WORKER_COUNT>::get_instance() {
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS> *unmined::task_manager<WORKER_COUNT, HOOKS>::get_instance() {
   if (instance_ == nullptr) instance_ = new task_manager();
   return instance_;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::add(task task) {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::add(task task) {
   {
     GUARD(pool_ntids_lock_);
     task.id = pool_ntIDs[task.settings[POOL]]++;
   }
+  task.queued = std::chrono::steady_clock::now();
+
+  std::string key = task.settings[KEY];
+  std::optional<retype> cached;
+  if (!key.empty()) {
+    GUARD(keys_lock_);
+    cached = results_.get(key);
+    auto it = in_flight_.find(key);
+    if (cached) {
+      cache_stats_.hits++;
+    } else if (it != in_flight_.end()) {
+      cache_stats_.joins++;
+      it->second.push_back(task);
+      return;
+    } else {
+      cache_stats_.misses++;
+      in_flight_[key];
+    }
+  }
+  // outside of keys_lock_, the sink may block
+  if (cached) {
+    _capture(task, *cached);
+    _finish(task, *cached);
+    return;
+  }
+
+  std::string after = task.settings[AFTER];
+  if (!after.empty()) {
+    GUARD(done_lock_);
+    refs_[after]++;
+  }
+  _push(task);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_push(task task) {
+  GUARD(queue_lock_);
+  queued_++;
+  std::string pool = task.settings[POOL];
+  auto [it, made] = queue_.try_emplace(pool);
+  pool_queue &q = it->second;
+  if (made) {
+    auto weight = weights_.find(pool);
+    q.name = pool;
+    q.weight = weight == weights_.end() ? 1 : weight->second;
+    active_.push_back(&q);
+  }
+
+  std::string affinity = task.settings[AFFINITY];
+  if (!affinity.empty()) {
+    auto &local = local_[std::hash<std::string>{}(affinity) % WORKER_COUNT];
+    if (local.size() < spill_limit_) {
+      q.local++;
+      local.push_back(std::move(task));
+      return;
+    }
+    affinity_stats_.spilled++;
+  }
+  q.tasks.push_back(std::move(task));
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_finish(task &t, const retype &r) {
   {
-    GUARD(queue_lock_);
-    queue_.push_back(task);
+    GUARD(done_lock_);
+    _done(t.name);
+  }
+  std::shared_ptr<result_sink> sink = util::get(sink_, sink_lock_);
+  if (!sink || get(KEEP_POOLS)) {
+    GUARD(pools_lock_);
+    pools_[t.settings[POOL]][t.id] = r.ret;
+  }
+  if (sink) (*sink)({t.name, t.settings[POOL], t.id, r});
+  if (t.finished) t.finished(r);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_sink(result_sink sink) {
+  GUARD(sink_lock_);
+  sink_ = sink ? std::make_shared<result_sink>(std::move(sink)) : nullptr;
+  if (stream_) stream_->close();
+  stream_ = nullptr;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::shared_ptr<unmined::channel<unmined::task_result>> unmined::task_manager<WORKER_COUNT, HOOKS>::stream(size_t capacity) {
+  auto out = make_channel<task_result>(capacity);
+  set_sink([out](task_result &&r) { out->push(std::move(r)); });
+  GUARD(sink_lock_);
+  stream_ = out;
+  return out;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::vector<std::pair<int, std::string>> unmined::task_manager<WORKER_COUNT, HOOKS>::drain(const std::string &pool,
+                                                                                             size_t max) {
+  std::vector<std::pair<int, std::string>> out;
+  GUARD(pools_lock_);
+  auto it = pools_.find(pool);
+  if (it == pools_.end()) return out;
+  auto &results = it->second;
+  while (!results.empty() && out.size() < max) {
+    auto node = results.extract(results.begin());
+    out.emplace_back(node.key(), std::move(node.mapped()));
+  }
+  if (results.empty()) pools_.erase(it);
+  return out;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::mark_done(const std::string &name) {
+  GUARD(done_lock_);
+  _done(name);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_done_limit(size_t limit) {
+  GUARD(done_lock_);
+  done_limit_ = limit;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_cache(size_t capacity, std::chrono::milliseconds ttl) {
+  GUARD(keys_lock_);
+  results_.resize(capacity, ttl);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::cache_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_cache_stats() {
+  GUARD(keys_lock_);
+  return cache_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_stats unmined::task_manager<WORKER_COUNT, HOOKS>::pool_stats(const std::string &pool) {
+  GUARD(stats_lock_);
+  auto it = pool_stats_.find(pool);
+  return it == pool_stats_.end() ? task_stats() : it->second;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_stats unmined::task_manager<WORKER_COUNT, HOOKS>::worker_stats(int wid) {
+  GUARD(stats_lock_);
+  if (wid < 0 || wid >= MAX_WORKERS) return {};
+  return worker_stats_[wid];
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, unmined::task_stats> unmined::task_manager<WORKER_COUNT, HOOKS>::pools_stats() {
+  GUARD(stats_lock_);
+  return pool_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_weight(const std::string &pool, int weight) {
+  GUARD(queue_lock_);
+  weight = std::max(weight, 1);
+  weights_[pool] = weight;
+  auto it = queue_.find(pool);
+  if (it != queue_.end()) it->second.weight = weight;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::chrono::nanoseconds unmined::task_manager<WORKER_COUNT, HOOKS>::wait_percentile(const std::string &pool, double p) {
+  GUARD(stats_lock_);
+  auto it = waits_.find(pool);
+  return it == waits_.end() ? std::chrono::nanoseconds(0) : it->second.percentile(p);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_spill(size_t limit) {
+  GUARD(queue_lock_);
+  spill_limit_ = limit;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_steal(size_t backlog) {
+  GUARD(queue_lock_);
+  steal_backlog_ = backlog;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::affinity_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_affinity_stats() {
+  GUARD(queue_lock_);
+  return affinity_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_compensation(std::chrono::milliseconds threshold, int cap) {
+  GUARD(compensation_lock_);
+  block_threshold_ = threshold;
+  compensation_cap_ = std::clamp(cap, 0, WORKER_COUNT);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::compensation_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_compensation_stats() {
+  GUARD(compensation_lock_);
+  return compensation_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::capture(const std::string &path) {
+  GUARD(capture_lock_);
+  capture_ = std::make_unique<capture_writer>(path);
+  if (!capture_->good()) {
+    capture_.reset();
+    capturing_ = false;
+    return false;
   }
+  capture_start_ = std::chrono::steady_clock::now();
+  capturing_ = true;
+  return true;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::stop_capture() {
+  GUARD(capture_lock_);
+  capturing_ = false;
+  capture_.reset();
 }
 
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::start() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::start() {
   GUARD(is_paused_lock_);
   is_paused_ = false;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::pause() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::pause() {
   GUARD(is_paused_lock_);
   is_paused_ = true;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::stop() {
-  GUARD(kill_lock_);
-  instance_ = nullptr;
-  stop_ = true;
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::stop() {
+  {
+    GUARD(kill_lock_);
+    instance_ = nullptr;
+    stop_ = true;
+  }
+  // a worker waiting on a full stream gives up its result, or it would never see stop_
+  GUARD(sink_lock_);
+  if (stream_) stream_->close();
 }
-template<int WORKER_COUNT>
-bool unmined::task_manager<WORKER_COUNT>::is_done() {
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::is_done() {
   GUARD(queue_lock_);
-  return queue_.empty();
+  return queued_ == 0;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::join() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::join() {
   main_thread_.join();
 }
 
-template<int WORKER_COUNT>
-std::vector<std::string> unmined::task_manager<WORKER_COUNT>::tasks() {
+template<int WORKER_COUNT, typename HOOKS>
+std::vector<std::string> unmined::task_manager<WORKER_COUNT, HOOKS>::tasks() {
   std::vector<std::string> out;
-  for (auto &i: queue_) {
-    out.push_back(i.name);
+  GUARD(queue_lock_);
+  for (auto &l: local_) {
+    for (auto &i: l) {
+      out.push_back(i.name);
+    }
+  }
+  for (auto *q: active_) {
+    for (auto &i: q->tasks) {
+      out.push_back(i.name);
+    }
   }
   return out;
 }
-template<int WORKER_COUNT>
-unmined::task unmined::task_manager<WORKER_COUNT>::_pop_queue() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task unmined::task_manager<WORKER_COUNT, HOOKS>::_pop_queue(int wid, bool skip_local) {
   GUARD(queue_lock_);
-  if (queue_.empty()) return task();
-  task t = queue_.front();
-  queue_.pop_front();
-  return t;
+  if (queued_ == 0) return task();
+
+  bool own = wid < WORKER_COUNT && !local_[wid].empty();
+  // takes the front of an affinity queue outside of its pool's turn
+  auto take_front = [&](std::deque<task> &from) {
+    task t = std::move(from.front());
+    from.pop_front();
+    queued_--;
+    auto it = queue_.find(t.settings[POOL]);
+    if (--it->second.local == 0 && it->second.tasks.empty()) {
+      active_.erase(std::find(active_.begin(), active_.end(), &it->second));
+      queue_.erase(it);
+    }
+    return t;
+  };
+  if (own && !skip_local && get(AFFINITY_FIRST)) {
+    affinity_stats_.local++;
+    return take_front(local_[wid]);
+  }
+
+  // deficit round robin, a pool starts its turn with its weight in tasks and passes once it has used them
+  for (size_t turns = active_.size(); turns > 0; --turns) {
+    pool_queue *q = active_.front();
+    bool local = false;
+    std::deque<task>::iterator mine;
+    if (own && !skip_local && q->local > 0) {
+      mine = std::find_if(local_[wid].begin(), local_[wid].end(), [&](task &t) { return t.settings[POOL] == q->name; });
+      local = mine != local_[wid].end();
+    }
+    if (!local && q->tasks.empty()) {
+      // what's left is queued for other workers, which take it in their turn or get it stolen
+      active_.pop_front();
+      active_.push_back(q);
+      continue;
+    }
+
+    if (q->deficit <= 0) q->deficit += q->weight;
+    q->deficit--;
+    queued_--;
+    task t;
+    if (local) {
+      t = std::move(*mine);
+      local_[wid].erase(mine);
+      q->local--;
+      affinity_stats_.local++;
+    } else {
+      t = std::move(q->tasks.front());
+      q->tasks.pop_front();
+    }
+
+    if (q->tasks.empty() && q->local == 0) {
+      active_.pop_front();
+      queue_.erase(queue_.find(q->name));
+    } else if (q->deficit <= 0) {
+      active_.pop_front();
+      active_.push_back(q);
+    }
+    return t;
+  }
+
+  // only from a worker that's behind, so a key doesn't move between workers whenever one is idle
+  size_t backlog = wid < WORKER_COUNT ? steal_backlog_ : 0;
+  std::deque<task> *victim = nullptr;
+  for (int i = 0; i < WORKER_COUNT; ++i) {
+    if (i == wid || local_[i].empty()) continue;
+    // the virtual workers of simulate are all running
+    if (local_[i].size() <= backlog && (simulating_ || states_[i].running)) continue;
+    if (!victim || local_[i].size() > victim->size()) victim = &local_[i];
+  }
+  if (victim) {
+    affinity_stats_.stolen++;
+    return take_front(*victim);
+  }
+  if (!own) return task();
+  affinity_stats_.local++;
+  return take_front(local_[wid]);
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::clear_pool(const std::string &pool) {
-  std::remove(pools_.begin(), pools_.end(), pools_.find(pool));
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::clear_pool(const std::string &pool) {
+  GUARD(pools_lock_);
+  pools_.erase(pool);
 }
-template<int WORKER_COUNT>
-std::unordered_map<std::string, std::unordered_map<int, std::string>> unmined::task_manager<WORKER_COUNT>::pools() {
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, std::unordered_map<int, std::string>> unmined::task_manager<WORKER_COUNT, HOOKS>::pools() {
   GUARD(pools_lock_);
   return pools_;
 }
-template<int WORKER_COUNT>
-std::unordered_map<int, std::string> unmined::task_manager<WORKER_COUNT>::pool(const std::string &name) {
-  std::vector<std::string> out;
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, size_t> unmined::task_manager<WORKER_COUNT, HOOKS>::pool_sizes() {
+  std::unordered_map<std::string, size_t> out;
+  GUARD(pools_lock_);
+  for (auto &[name, results]: pools_) out[name] = results.size();
+  return out;
+}
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<int, std::string> unmined::task_manager<WORKER_COUNT, HOOKS>::pool(const std::string &name) {
   GUARD(pools_lock_);
-  return pools_[name];
+  auto it = pools_.find(name);
+  return it == pools_.end() ? std::unordered_map<int, std::string>() : it->second;
 }
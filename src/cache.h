@@ -0,0 +1,119 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CACHE_H_
+#define TASK_MANAGER_SRC_CACHE_H_
+
+#include <chrono>
+#include <list>
+#include <optional>
+#include <unordered_map>
+
+namespace unmined {
+
+/**
+ * @brief A bounded least recently used cache, where entries can also expire after a time to live
+ * @tparam K The type of the key
+ * @tparam V The type of the value
+ */
+template<typename K, typename V>
+class lru_cache {
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct entry {
+    K key;
+    V value;
+    clock::time_point stored;
+  };
+
+  /// The entries, most recently used first
+  std::list<entry> order_;
+  /// The entries by key, pointing into order_
+  std::unordered_map<K, typename std::list<entry>::iterator> index_;
+  /// The max amount of entries, 0 stores nothing
+  size_t capacity_;
+  /// How long an entry lives for, 0 lives forever
+  std::chrono::milliseconds ttl_;
+
+ public:
+  /**
+   * @brief Makes a new cache
+   * @param capacity size_t - The max amount of entries
+   * @param ttl milliseconds - How long an entry lives for, 0 for forever
+   */
+  explicit lru_cache(size_t capacity = 0, std::chrono::milliseconds ttl = std::chrono::milliseconds(0))
+      : capacity_(capacity), ttl_(ttl) {}
+
+  /**
+   * @brief Gets an entry and marks it as the most recently used
+   * @param key K - The key of the entry
+   * @return optional<V> - The value, or nothing if it is missing or expired
+   */
+  std::optional<V> get(const K &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) return std::nullopt;
+    if (ttl_.count() > 0 && clock::now() - it->second->stored > ttl_) {
+      order_.erase(it->second);
+      index_.erase(it);
+      return std::nullopt;
+    }
+    order_.splice(order_.begin(), order_, it->second);
+    return it->second->value;
+  }
+
+  /**
+   * @brief Stores an entry, evicting the least recently used one if full
+   * @param key K - The key of the entry
+   * @param value V - The value of the entry
+   */
+  void put(const K &key, V value) {
+    if (capacity_ == 0) return;
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      order_.erase(it->second);
+      index_.erase(it);
+    }
+    order_.push_front({key, std::move(value), clock::now()});
+    index_[key] = order_.begin();
+    while (index_.size() > capacity_) {
+      index_.erase(order_.back().key);
+      order_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Changes the capacity and time to live, evicting what no longer fits
+   * @param capacity size_t - The max amount of entries
+   * @param ttl milliseconds - How long an entry lives for, 0 for forever
+   */
+  void resize(size_t capacity, std::chrono::milliseconds ttl) {
+    capacity_ = capacity;
+    ttl_ = ttl;
+    while (index_.size() > capacity_) {
+      index_.erase(order_.back().key);
+      order_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Removes every entry
+   */
+  void clear() {
+    order_.clear();
+    index_.clear();
+  }
+
+  /**
+   * @brief Gets the amount of entries
+   * @return size_t - The amount of entries, expired ones included
+   */
+  size_t size() const {
+    return index_.size();
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_CACHE_H_
@@ -0,0 +1,159 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CAPTURE_H_
+#define TASK_MANAGER_SRC_CAPTURE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace unmined {
+
+/**
+ * @brief What a capture keeps of a task, everything but what it does
+ */
+struct capture_record {
+  /// When the task was added, in nanoseconds since the capture started
+  int64_t submitted = 0;
+  /// The wall time the task ran for, in nanoseconds
+  uint64_t runtime = 0;
+  /// The CPU time the task ran for, in nanoseconds
+  uint64_t cpu = 0;
+  /// The size of the result
+  uint64_t result_size = 0;
+  std::string name;
+  std::string pool;
+  std::string after;
+};
+
+/**
+ * @brief Writes capture records to a file
+ *
+ * The file is the 8 byte magic "TMCAP001", then each record as varints (the submit time zigzag encoded) and length
+ * prefixed strings, in the order the tasks ran.
+ */
+class capture_writer {
+ private:
+  std::ofstream out_;
+  std::string buf_;
+
+  void _varint(uint64_t v) {
+    while (v >= 0x80) {
+      buf_ += (char) (v | 0x80);
+      v >>= 7;
+    }
+    buf_ += (char) v;
+  }
+
+  void _string(const std::string &s) {
+    _varint(s.size());
+    buf_ += s;
+  }
+
+ public:
+  static constexpr char MAGIC[8] = {'T', 'M', 'C', 'A', 'P', '0', '0', '1'};
+
+  /**
+   * @brief Opens a capture file, replacing any that's there
+   * @param path string - The path of the file
+   */
+  explicit capture_writer(const std::string &path) : out_(path, std::ios::binary | std::ios::trunc) {
+    out_.write(MAGIC, sizeof(MAGIC));
+  }
+
+  ~capture_writer() {
+    flush();
+  }
+
+  /**
+   * @brief Checks if the file opened
+   * @return bool - If records can be written
+   */
+  bool good() const {
+    return out_.good();
+  }
+
+  /**
+   * @brief Adds a record, written out once 64KiB are buffered or on flush
+   * @param r capture_record - The record
+   */
+  void write(const capture_record &r) {
+    _varint(((uint64_t) r.submitted << 1) ^ (uint64_t) (r.submitted >> 63));
+    _varint(r.runtime);
+    _varint(r.cpu);
+    _varint(r.result_size);
+    _string(r.name);
+    _string(r.pool);
+    _string(r.after);
+    if (buf_.size() >= 1 << 16) flush();
+  }
+
+  /**
+   * @brief Writes out the buffered records
+   */
+  void flush() {
+    out_.write(buf_.data(), (std::streamsize) buf_.size());
+    out_.flush();
+    buf_.clear();
+  }
+};
+
+/**
+ * @brief Reads every record of a capture file
+ * @param path string - The path of the file
+ * @return vector<capture_record> - The records in the order the tasks ran, empty if the file isn't a capture
+ */
+inline std::vector<capture_record> read_capture(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<capture_record> out;
+  if (data.compare(0, sizeof(capture_writer::MAGIC), capture_writer::MAGIC, sizeof(capture_writer::MAGIC)) != 0)
+    return out;
+
+  size_t pos = sizeof(capture_writer::MAGIC);
+  bool ok = true;
+  auto varint = [&]() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= data.size()) break;
+      auto b = (uint8_t) data[pos++];
+      v |= (uint64_t) (b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return v;
+  };
+  auto string = [&]() {
+    uint64_t len = varint();
+    if (!ok || len > data.size() - pos) {
+      ok = false;
+      return std::string();
+    }
+    std::string s = data.substr(pos, len);
+    pos += len;
+    return s;
+  };
+
+  while (pos < data.size()) {
+    capture_record r;
+    uint64_t zigzag = varint();
+    r.submitted = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+    r.runtime = varint();
+    r.cpu = varint();
+    r.result_size = varint();
+    r.name = string();
+    r.pool = string();
+    r.after = string();
+    // a capture cut off mid record, e.g. by a crash, keeps the records before it
+    if (!ok) break;
+    out.push_back(std::move(r));
+  }
+  return out;
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_CAPTURE_H_
@@ -0,0 +1,195 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_CHANNEL_H_
+#define TASK_MANAGER_SRC_CHANNEL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "task_manager.h"
+
+namespace unmined {
+
+/**
+ * @brief A bounded queue between threads, pushing blocks while it's full and popping blocks while it's empty
+ *
+ * It closes once every producer has called close, after which pops drain what's left and then fail.
+ * @tparam T The type of the items
+ */
+template<typename T>
+class channel {
+ private:
+  std::deque<T> items_;
+  /// The max amount of items held
+  size_t capacity_;
+  /// The amount of producers that haven't closed yet
+  int producers_;
+
+  std::mutex lock_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+
+ public:
+  /**
+   * @brief Makes a new channel
+   * @param capacity size_t - The max amount of items held before pushing blocks
+   * @param producers int - The amount of producers that have to close it
+   */
+  explicit channel(size_t capacity, int producers = 1) : capacity_(capacity ? capacity : 1), producers_(producers) {}
+
+  /**
+   * @brief Adds an item, waiting for room
+   * @param item T - The item
+   * @return bool - false if the channel was closed
+   */
+  bool push(T item) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_full_.wait(guard, [this]() { return items_.size() < capacity_ || producers_ <= 0; });
+    if (producers_ <= 0) return false;
+    items_.push_back(std::move(item));
+    guard.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest item, waiting for one
+   * @param out T - Where the item is moved to
+   * @return bool - false if the channel is closed and empty
+   */
+  bool pop(T &out) {
+    std::unique_lock<std::mutex> guard(lock_);
+    not_empty_.wait(guard, [this]() { return !items_.empty() || producers_ <= 0; });
+    if (items_.empty()) return false;
+    out = std::move(items_.front());
+    items_.pop_front();
+    guard.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest item if there is one, without waiting
+   * @param out T - Where the item is moved to
+   * @return bool - If an item was taken
+   */
+  bool try_pop(T &out) {
+    {
+      GUARD(lock_);
+      if (items_.empty()) return false;
+      out = std::move(items_.front());
+      items_.pop_front();
+    }
+    not_full_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Marks one producer as done, closing the channel once they all are
+   */
+  void close() {
+    {
+      GUARD(lock_);
+      producers_--;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  /**
+   * @brief Checks if every producer is done
+   * @return bool - If the channel is closed
+   */
+  bool closed() {
+    GUARD(lock_);
+    return producers_ <= 0;
+  }
+
+  /**
+   * @brief Gets the amount of items held
+   * @return size_t - The amount of items
+   */
+  size_t size() {
+    GUARD(lock_);
+    return items_.size();
+  }
+};
+
+/**
+ * @brief Makes a channel to pass between stages
+ * @tparam T The type of the items
+ * @param capacity size_t - The max amount of items held
+ * @param producers int - The amount of producers that have to close it
+ * @return shared_ptr<channel<T>> - The channel
+ */
+template<typename T>
+std::shared_ptr<channel<T>> make_channel(size_t capacity, int producers = 1) {
+  return std::make_shared<channel<T>>(capacity, producers);
+}
+
+/**
+ * @brief Makes a task that feeds a channel until the generator says it's done, then closes it
+ * @param name string - The name of the task
+ * @param out channel - The channel to feed
+ * @param gen function - Sets the next item and returns true, or returns false when done
+ * @return task - The task, its result is the amount of items fed
+ */
+template<typename Out, typename F>
+task source(const std::string &name, std::shared_ptr<channel<Out>> out, F gen) {
+  return {name, [out, gen]() mutable {
+    uint64_t n = 0;
+    Out item;
+    while (gen(item) && out->push(std::move(item))) n++;
+    out->close();
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+/**
+ * @brief Makes a task that takes every item from one channel, and feeds what fn returns into another
+ *
+ * The task runs until its input closes, so it holds a worker for that long, the task manager needs at least as many
+ * workers as there are stages in a stream or it'll stall.
+ * @param name string - The name of the task
+ * @param in channel - The channel to take from
+ * @param out channel - The channel to feed
+ * @param fn function - Turns an In into an Out
+ * @return task - The task, its result is the amount of items passed on
+ */
+template<typename In, typename Out, typename F>
+task stage(const std::string &name, std::shared_ptr<channel<In>> in, std::shared_ptr<channel<Out>> out, F fn) {
+  return {name, [in, out, fn]() mutable {
+    uint64_t n = 0;
+    In item;
+    while (in->pop(item) && out->push(fn(std::move(item)))) n++;
+    out->close();
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+/**
+ * @brief Makes a task that takes every item from a channel and gives it to fn
+ * @param name string - The name of the task
+ * @param in channel - The channel to take from
+ * @param fn function - Takes an In
+ * @return task - The task, its result is the amount of items taken
+ */
+template<typename In, typename F>
+task sink(const std::string &name, std::shared_ptr<channel<In>> in, F fn) {
+  return {name, [in, fn]() mutable {
+    uint64_t n = 0;
+    In item;
+    while (in->pop(item)) {
+      fn(std::move(item));
+      n++;
+    }
+    return retype{std::to_string(n), 0};
+  }};
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_CHANNEL_H_
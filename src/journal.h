@@ -0,0 +1,579 @@
+//
+// Created by christian on 10/19/26.
+//
+
+#ifndef TASK_MANAGER_SRC_JOURNAL_H_
+#define TASK_MANAGER_SRC_JOURNAL_H_
+
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "registry.h"
+#include "task_manager.h"
+
+namespace unmined {
+
+/**
+ * @brief A task in the journal, described by its registered type and serialized arguments
+ */
+struct journal_entry {
+  uint64_t seq = 0;
+  std::string type;
+  std::string args;
+  std::string name;
+  std::string pool;
+  std::string after;
+};
+
+/**
+ * @brief An append only log of submitted and completed tasks, so the tasks that didn't finish can be run again after a
+ * crash
+ *
+ * Records are buffered, then written and fdatasync'd in one batch every commit interval (group commit), so adding
+ * doesn't wait on the disk, sync() does. Opening a journal replays the file through mmap to find the tasks that were
+ * submitted but never completed, dropping a torn record at the end. A file that doesn't start with the magic is left
+ * alone and the journal isn't good(). Once there are more completed tasks in the file than pending ones (and at least
+ * compact_after), it's rewritten with only the pending ones, without holding up submit and complete while it's written.
+ * Only the writer thread touches the file once it's open, compaction included.
+ *
+ * A batch that fails to write or sync is cut back off the file and retried on the next commit, sync() reports the
+ * failure.
+ *
+ * The file is the 8 byte magic "TMJNL001", then records of a 1 byte kind, a 4 byte length, the body and a 4 byte
+ * FNV-1a of the body. A submit's body is its sequence number and the 5 strings of the entry, each length prefixed,
+ * a complete's body is the sequence number.
+ */
+class journal {
+ private:
+  enum kinds : uint8_t {
+    SUBMIT = 1,
+    COMPLETE = 2,
+  };
+
+  static constexpr char MAGIC[8] = {'T', 'M', 'J', 'N', 'L', '0', '0', '1'};
+
+  std::string path_;
+  /// The file, only used by the writer thread once it's started
+  int fd_ = -1;
+  /// The bytes of whole records in the file
+  uint64_t size_ = 0;
+  /// How often buffered records are written and synced
+  std::chrono::milliseconds commit_interval_;
+  /// The least completed records in the file before it's compacted
+  uint64_t compact_after_;
+
+  /// The submitted tasks that haven't completed, by sequence number
+  std::map<uint64_t, journal_entry> live_;
+  /// The tasks found pending when the journal was opened
+  std::vector<journal_entry> recovered_;
+  /// The records not written yet
+  std::string buf_;
+  uint64_t next_seq_ = 0;
+  /// The records added so far
+  uint64_t appended_ = 0;
+  /// The records added so far that are on disk
+  uint64_t durable_ = 0;
+  /// The completed records in the file
+  uint64_t dead_ = 0;
+  uint64_t compactions_ = 0;
+  /// The amount of batches that failed to write or sync
+  uint64_t failures_ = 0;
+  /// The errno of the last failure, 0 once a batch is written again
+  int error_ = 0;
+  /// If compact was called and the writer hasn't compacted yet
+  bool compact_ = false;
+  bool stop_ = false;
+
+  std::thread writer_;
+  std::mutex lock_;
+  std::condition_variable wake_;
+  std::condition_variable durable_cv_;
+
+  static uint32_t _hash(const char *data, size_t len);
+  static void _put(std::string &out, const void *data, size_t len);
+  static void _put_string(std::string &out, const std::string &s);
+  static void _record(std::string &out, kinds kind, const std::string &body);
+  static std::string _submit_body(const journal_entry &e);
+  static bool _write_full(int fd, const char *data, size_t len);
+
+  /**
+   * @brief Reads the file into live_, and cuts off anything after the last whole record
+   */
+  void _replay();
+  /**
+   * @brief Writes and syncs buffered records every commit interval, and compacts the file
+   */
+  void _write();
+  /**
+   * @brief Rewrites the file with only the live tasks, on the writer thread
+   *
+   * The live tasks are copied under lock_ and written to a new file without it, then the records added meanwhile are
+   * appended under lock_ and the new file replaces the old one.
+   * @param guard unique_lock - The held lock_, unlocked while writing and held again on return
+   * @return bool - If the file was rewritten
+   */
+  bool _compact(std::unique_lock<std::mutex> &guard);
+
+ public:
+  /**
+   * @brief Opens a journal, replaying what's already in it
+   * @param path string - The path of the file, made if it doesn't exist
+   * @param commit_interval milliseconds - How often buffered records are written and synced, default 2ms
+   * @param compact_after uint64_t - The least completed records in the file before it's compacted, default 1M
+   */
+  explicit journal(const std::string &path,
+                   std::chrono::milliseconds commit_interval = std::chrono::milliseconds(2),
+                   uint64_t compact_after = 1'000'000);
+  /// writes what's buffered and closes the file
+  ~journal();
+
+  journal(journal &other) = delete;
+  void operator=(const journal &) = delete;
+
+  /**
+   * @brief Checks if the file opened
+   * @return bool - If records can be written
+   */
+  bool good() const;
+
+  /**
+   * @brief Adds a submitted task, it's on disk by the next commit
+   * @param e journal_entry - The task, its seq is set by the journal
+   * @return uint64_t - The sequence number of the task
+   */
+  uint64_t submit(journal_entry e);
+
+  /**
+   * @brief Adds that a task completed, so it won't be recovered
+   * @param seq uint64_t - The sequence number of the task
+   */
+  void complete(uint64_t seq);
+
+  /**
+   * @brief Waits until everything added so far is on disk
+   * @return bool - false if writing it failed, see error
+   */
+  bool sync();
+
+  /**
+   * @brief Rewrites the file with only the pending tasks now
+   * @return bool - If the file was rewritten
+   */
+  bool compact();
+
+  /**
+   * @brief Gets why the last batch failed to write or sync
+   * @return int - The errno, 0 if the last batch was written
+   */
+  int error();
+
+  /**
+   * @brief Gets the tasks that were pending when the journal was opened
+   * @return vector<journal_entry> - The tasks, in the order they were submitted
+   */
+  const std::vector<journal_entry> &recovered() const;
+
+  /**
+   * @brief Gets the amount of tasks submitted and not completed
+   * @return size_t - The amount of tasks
+   */
+  size_t pending();
+
+  /**
+   * @brief Gets how many times the file has been compacted
+   * @return uint64_t - The amount of compactions
+   */
+  uint64_t compactions();
+};
+
+inline journal::journal(const std::string &path, std::chrono::milliseconds commit_interval, uint64_t compact_after)
+    : path_(path), commit_interval_(commit_interval), compact_after_(compact_after) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) return;
+  _replay();
+  if (fd_ < 0) return;
+  for (auto &[seq, e]: live_) recovered_.push_back(e);
+  writer_ = std::thread(&journal::_write, this);
+}
+
+inline journal::~journal() {
+  if (!writer_.joinable()) return;
+  {
+    GUARD(lock_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  writer_.join();
+  if (fd_ >= 0) close(fd_);
+}
+
+inline bool journal::good() const {
+  return writer_.joinable();
+}
+
+inline uint32_t journal::_hash(const char *data, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t) data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+inline void journal::_put(std::string &out, const void *data, size_t len) {
+  out.append(static_cast<const char *>(data), len);
+}
+
+inline void journal::_put_string(std::string &out, const std::string &s) {
+  auto len = (uint32_t) s.size();
+  _put(out, &len, sizeof(len));
+  out += s;
+}
+
+inline void journal::_record(std::string &out, kinds kind, const std::string &body) {
+  auto len = (uint32_t) body.size();
+  uint32_t hash = _hash(body.data(), body.size());
+  _put(out, &kind, sizeof(kind));
+  _put(out, &len, sizeof(len));
+  out += body;
+  _put(out, &hash, sizeof(hash));
+}
+
+inline std::string journal::_submit_body(const journal_entry &e) {
+  std::string body;
+  _put(body, &e.seq, sizeof(e.seq));
+  _put_string(body, e.type);
+  _put_string(body, e.args);
+  _put_string(body, e.name);
+  _put_string(body, e.pool);
+  _put_string(body, e.after);
+  return body;
+}
+
+inline bool journal::_write_full(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n <= 0) return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline void journal::_replay() {
+  struct stat st{};
+  fstat(fd_, &st);
+  auto size = (size_t) st.st_size;
+  if (size < sizeof(MAGIC)) {
+    // new, or cut off before the magic was written, anything else isn't a journal
+    char head[sizeof(MAGIC)];
+    if (pread(fd_, head, size, 0) != (ssize_t) size || memcmp(head, MAGIC, size) != 0) {
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    if (ftruncate(fd_, 0) != 0 || !_write_full(fd_, MAGIC, sizeof(MAGIC)) || fdatasync(fd_) != 0) {
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    size_ = sizeof(MAGIC);
+    return;
+  }
+
+  void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (mem == MAP_FAILED) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  const char *data = static_cast<const char *>(mem);
+  if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+    munmap(mem, size);
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  size_t pos = sizeof(MAGIC);
+  madvise(mem, size, MADV_SEQUENTIAL);
+
+  auto take = [&](const char *&p, const char *end, void *out, size_t len) {
+    if ((size_t) (end - p) < len) return false;
+    memcpy(out, p, len);
+    p += len;
+    return true;
+  };
+  auto take_string = [&](const char *&p, const char *end, std::string &out) {
+    uint32_t len;
+    if (!take(p, end, &len, sizeof(len)) || (size_t) (end - p) < len) return false;
+    out.assign(p, len);
+    p += len;
+    return true;
+  };
+
+  while (pos + 9 <= size) {
+    uint8_t kind;
+    uint32_t len, hash;
+    memcpy(&kind, data + pos, 1);
+    memcpy(&len, data + pos + 1, 4);
+    if (pos + 9 + (size_t) len > size) break;
+    const char *body = data + pos + 5;
+    memcpy(&hash, body + len, 4);
+    if (hash != _hash(body, len)) break;
+
+    const char *p = body, *end = body + len;
+    journal_entry e;
+    if (!take(p, end, &e.seq, sizeof(e.seq))) break;
+    if (kind == SUBMIT) {
+      if (!take_string(p, end, e.type) || !take_string(p, end, e.args) || !take_string(p, end, e.name)
+          || !take_string(p, end, e.pool) || !take_string(p, end, e.after))
+        break;
+      live_[e.seq] = std::move(e);
+    } else if (kind == COMPLETE) {
+      live_.erase(e.seq);
+      dead_++;
+    } else {
+      break;
+    }
+    next_seq_ = std::max(next_seq_, e.seq + 1);
+    pos += 9 + len;
+  }
+  munmap(mem, size);
+
+  // a record torn by a crash is dropped, so new ones go after the last whole one
+  if (pos != size && ftruncate(fd_, (off_t) pos) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  size_ = pos;
+}
+
+inline void journal::_write() {
+  std::string batch;
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    wake_.wait_for(guard, commit_interval_, [this]() { return stop_ || compact_ || buf_.size() >= (1 << 20); });
+
+    if (!buf_.empty()) {
+      batch.swap(buf_);
+      uint64_t committing = appended_;
+      guard.unlock();
+      bool ok = _write_full(fd_, batch.data(), batch.size()) && fdatasync(fd_) == 0;
+      int err = ok ? 0 : errno;
+      // a partly written batch would leave a torn record that hides everything after it
+      if (!ok && ftruncate(fd_, (off_t) size_) != 0) {}
+      guard.lock();
+
+      if (ok) {
+        size_ += batch.size();
+        durable_ = std::max(durable_, committing);
+        error_ = 0;
+      } else {
+        batch += buf_;
+        buf_.swap(batch);
+        failures_++;
+        error_ = err;
+      }
+      batch.clear();
+      if (!ok) {
+        durable_cv_.notify_all();
+        if (stop_) return;
+        continue;
+      }
+    }
+
+    if (compact_ || (dead_ >= compact_after_ && dead_ > live_.size())) {
+      _compact(guard);
+      compact_ = false;
+    }
+    durable_cv_.notify_all();
+    if (stop_ && buf_.empty()) return;
+  }
+}
+
+inline bool journal::_compact(std::unique_lock<std::mutex> &guard) {
+  // what's buffered now is in live_, so only what's added after it goes after the live tasks
+  std::vector<journal_entry> live;
+  live.reserve(live_.size());
+  for (auto &[seq, e]: live_) live.push_back(e);
+  size_t skip = buf_.size();
+  uint64_t dead = dead_;
+  guard.unlock();
+
+  std::string tmp_path = path_ + ".compact";
+  int tmp = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  std::string out(MAGIC, sizeof(MAGIC));
+  uint64_t written = 0;
+  bool ok = tmp >= 0;
+  for (auto &e: live) {
+    _record(out, SUBMIT, _submit_body(e));
+    if (out.size() >= 1 << 20) {
+      ok = ok && _write_full(tmp, out.data(), out.size());
+      written += out.size();
+      out.clear();
+    }
+  }
+  ok = ok && _write_full(tmp, out.data(), out.size());
+  written += out.size();
+  ok = ok && fdatasync(tmp) == 0;
+  guard.lock();
+
+  ok = ok && _write_full(tmp, buf_.data() + skip, buf_.size() - skip) && fdatasync(tmp) == 0;
+  if (tmp >= 0) close(tmp);
+  if (!ok || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  written += buf_.size() - skip;
+
+  // the rename has to be on disk too, or a crash could bring the old file back
+  std::string dir = path_.find('/') == std::string::npos ? "." : path_.substr(0, path_.rfind('/') + 1);
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  close(fd_);
+  fd_ = open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+  size_ = written;
+  // everything buffered is in the new file, and only the completes added since the copy are
+  buf_.clear();
+  durable_ = appended_;
+  dead_ -= dead;
+  compactions_++;
+  return true;
+}
+
+inline uint64_t journal::submit(journal_entry e) {
+  GUARD(lock_);
+  e.seq = next_seq_++;
+  _record(buf_, SUBMIT, _submit_body(e));
+  appended_++;
+  uint64_t seq = e.seq;
+  live_[seq] = std::move(e);
+  return seq;
+}
+
+inline void journal::complete(uint64_t seq) {
+  std::string body;
+  _put(body, &seq, sizeof(seq));
+  GUARD(lock_);
+  _record(buf_, COMPLETE, body);
+  appended_++;
+  live_.erase(seq);
+  dead_++;
+}
+
+inline bool journal::sync() {
+  std::unique_lock<std::mutex> guard(lock_);
+  if (!writer_.joinable()) return false;
+  uint64_t target = appended_, failures = failures_;
+  wake_.notify_all();
+  durable_cv_.wait(guard, [&]() { return durable_ >= target || failures_ != failures; });
+  return durable_ >= target;
+}
+
+inline bool journal::compact() {
+  std::unique_lock<std::mutex> guard(lock_);
+  if (!writer_.joinable()) return false;
+  uint64_t compactions = compactions_, failures = failures_;
+  compact_ = true;
+  wake_.notify_all();
+  durable_cv_.wait(guard, [&]() { return !compact_ || failures_ != failures; });
+  return compactions_ != compactions;
+}
+
+inline int journal::error() {
+  GUARD(lock_);
+  return error_;
+}
+
+inline const std::vector<journal_entry> &journal::recovered() const {
+  return recovered_;
+}
+
+inline size_t journal::pending() {
+  GUARD(lock_);
+  return live_.size();
+}
+
+inline uint64_t journal::compactions() {
+  GUARD(lock_);
+  return compactions_;
+}
+
+/**
+ * @brief Adds a task described by a registered type and its arguments, journaling it first
+ * @param tm task_manager - The task manager to add it to
+ * @param j journal - The journal, which must outlive the task
+ * @param name string - The name of the task
+ * @param type string - The registered type of the task
+ * @param args string - The serialized arguments
+ * @param pool string - The pool the result goes to, defaults to the name
+ * @param after string - The task it's after
+ * @return uint64_t - The sequence number of the task in the journal
+ */
+template<int WORKER_COUNT, typename HOOKS>
+uint64_t add_journaled(task_manager<WORKER_COUNT, HOOKS> *tm,
+                       std::shared_ptr<journal> j,
+                       const std::string &name,
+                       const std::string &type,
+                       const std::string &args,
+                       const std::string &pool = "",
+                       const std::string &after = "") {
+  journal_entry e{0, type, args, name, pool.empty() ? name : pool, after};
+  uint64_t seq = j->submit(e);
+  task t{name,
+         [type, args]() { return task_registry::get_instance()->run(type, args); },
+         {
+             {AFTER, e.after},
+             {POOL, e.pool},
+         }};
+  // only once the result is stored, a crash before that has to run it again
+  t.finished = [j, seq](const retype &) { j->complete(seq); };
+  tm->add(std::move(t));
+  return seq;
+}
+
+/**
+ * @brief Adds back the tasks a journal found pending when it was opened
+ *
+ * Tasks they're after that aren't pending are marked as done, since they completed before the crash.
+ * @param tm task_manager - The task manager to add them to
+ * @param j journal - The journal, which must outlive the tasks
+ * @return size_t - The amount of tasks added back
+ */
+template<int WORKER_COUNT, typename HOOKS>
+size_t recover(task_manager<WORKER_COUNT, HOOKS> *tm, std::shared_ptr<journal> j) {
+  std::set<std::string> pending;
+  for (auto &e: j->recovered()) pending.insert(e.name);
+  for (auto &e: j->recovered()) {
+    if (!e.after.empty() && !pending.contains(e.after)) tm->mark_done(e.after);
+  }
+
+  for (auto &e: j->recovered()) {
+    uint64_t seq = e.seq;
+    std::string type = e.type, args = e.args;
+    task t{e.name,
+           [type, args]() { return task_registry::get_instance()->run(type, args); },
+           {
+               {AFTER, e.after},
+               {POOL, e.pool},
+           }};
+    t.finished = [j, seq](const retype &) { j->complete(seq); };
+    tm->add(std::move(t));
+  }
+  return j->recovered().size();
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_JOURNAL_H_
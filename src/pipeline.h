@@ -0,0 +1,118 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_PIPELINE_H_
+#define TASK_MANAGER_SRC_PIPELINE_H_
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "task_manager.h"
+
+namespace unmined {
+
+namespace detail {
+
+/**
+ * @brief Walks the stages of a pipeline at compile time, checking each can take what the one before returns
+ * @tparam In The type going into the first stage
+ * @tparam Stages The stages
+ */
+template<typename In, typename... Stages>
+struct chain {
+  static constexpr bool valid = true;
+  /// The index of the first stage that can't take its input, or the amount of stages if they all can
+  static constexpr size_t broken_at = 0;
+  using type = In;
+};
+
+template<typename In, typename S, typename... Rest>
+struct chain<In, S, Rest...> {
+  static constexpr bool step = std::is_invocable_v<S, In>;
+  using out = typename std::conditional_t<step, std::invoke_result<S, In>, std::type_identity<void>>::type;
+  using next = chain<out, Rest...>;
+
+  static constexpr bool valid = step && next::valid;
+  static constexpr size_t broken_at = step ? next::broken_at + 1 : 0;
+  using type = typename next::type;
+};
+
+/**
+ * @brief Turns what the last stage returns into a task result
+ */
+template<typename T>
+retype to_retype(T &&val) {
+  using V = std::remove_cvref_t<T>;
+  if constexpr (std::is_same_v<V, retype>) return std::forward<T>(val);
+  else if constexpr (std::is_convertible_v<T, std::string>) return {std::string(std::forward<T>(val)), 0};
+  else if constexpr (std::is_arithmetic_v<V>) return {std::to_string(val), 0};
+  else static_assert(sizeof(V) == 0, "the last stage of a pipeline must return retype, a string or a number");
+}
+
+}
+
+/**
+ * @brief A pipeline whose stages are known at compile time, e.g. pipeline<parse, transform, store>
+ *
+ * Each stage is a default constructible function object, and takes what the stage before it returns. The stages are
+ * checked when the pipeline is run, called directly so they can be inlined, and values are moved between them
+ * without going through retype.
+ * @tparam Stages The stages, in order
+ */
+template<typename... Stages>
+class pipeline {
+  static_assert(sizeof...(Stages) > 0, "a pipeline needs at least one stage");
+
+ private:
+  template<typename S, typename... Rest, typename In>
+  static constexpr decltype(auto) _run(In &&in) {
+    if constexpr (sizeof...(Rest) == 0) return S{}(std::forward<In>(in));
+    else return _run<Rest...>(S{}(std::forward<In>(in)));
+  }
+
+ public:
+  /// If the stages can be run in order starting from an In
+  template<typename In>
+  static constexpr bool accepts = detail::chain<In, Stages...>::valid;
+
+  /// The index of the first stage that can't take its input, when starting from an In
+  template<typename In>
+  static constexpr size_t broken_at = detail::chain<In, Stages...>::broken_at;
+
+  /// What the last stage returns, when starting from an In
+  template<typename In>
+  using result_t = typename detail::chain<In, Stages...>::type;
+
+  /**
+   * @brief Runs every stage on the calling thread
+   * @param in In - The input of the first stage
+   * @return result_t<In> - What the last stage returns
+   */
+  template<typename In>
+  static constexpr decltype(auto) run(In &&in) {
+    using c = detail::chain<In, Stages...>;
+    static_assert(c::valid, "a stage of the pipeline can't take what the stage before it returns, check broken_at<In>");
+    return _run<Stages...>(std::forward<In>(in));
+  }
+
+  /**
+   * @brief Makes a task that runs the whole pipeline on one worker
+   * @param name string - The name of the task
+   * @param in In - The input of the first stage
+   * @return task - The task, with default settings
+   */
+  template<typename In>
+  static task make_task(const std::string &name, In in) {
+    // shared so that move only inputs still fit in a std::function
+    auto held = std::make_shared<std::remove_cvref_t<In>>(std::move(in));
+    return {name, [held]() {
+      return detail::to_retype(run(std::move(*held)));
+    }};
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_PIPELINE_H_
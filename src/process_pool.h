@@ -0,0 +1,538 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_PROCESS_POOL_H_
+#define TASK_MANAGER_SRC_PROCESS_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "registry.h"
+
+namespace unmined {
+
+/**
+ * @brief A pool of local worker processes that run registered task types, so a crash only takes down its worker
+ *
+ * Requests are written to each worker over a unix socket and can be pipelined, the worker runs them in order.
+ * Results are written straight into a ring of shared memory per worker, and only fall back to the socket when they
+ * don't fit. A worker that dies is respawned, the request it was running fails with WORKER_DIED and the ones queued
+ * behind it are sent to the new worker.
+ *
+ * Workers are forked, so task types have to be registered in the task_registry before the pool is made (or before
+ * the worker respawns) for them to exist in the worker.
+ */
+class process_pool {
+ private:
+  /// The start of each worker's shared memory
+  struct shm_header {
+    /// The total bytes of the ring the parent has read, written by the parent
+    alignas(64) std::atomic<uint64_t> consumed;
+    /// The request the worker is running, written by the worker
+    alignas(64) std::atomic<uint64_t> running;
+  };
+
+  /// The header of a request frame, followed by the type and the arguments
+  struct request_header {
+    uint64_t seq;
+    uint32_t type_len;
+    uint32_t args_len;
+  };
+
+  /// The header of a response frame, followed by the result if it isn't in shared memory
+  struct response_header {
+    uint64_t seq;
+    int32_t err;
+    uint32_t in_shm;
+    uint64_t offset;
+    uint64_t len;
+    /// How far the ring moved for this result
+    uint64_t advance;
+  };
+
+  struct request {
+    std::string type;
+    std::string args;
+    std::function<void(const retype &)> done;
+  };
+
+  struct worker {
+    pid_t pid = -1;
+    int fd = -1;
+    shm_header *shm = nullptr;
+    bool dead = false;
+    /// Held while writing to fd, so frames don't interleave
+    std::mutex write_lock;
+    /// The requests sent but not answered, by sequence number
+    std::map<uint64_t, std::shared_ptr<request>> pending;
+    /// The bytes read that don't make a full frame yet
+    std::string inbox;
+  };
+
+  /// The requests a respawned worker has to be sent again
+  struct resend_job {
+    std::shared_ptr<worker> to;
+    std::map<uint64_t, std::shared_ptr<request>> requests;
+  };
+
+  static constexpr uint64_t IDLE = ~0ull;
+
+  std::vector<std::shared_ptr<worker>> workers_;
+  /// The size of each worker's result ring
+  size_t ring_size_;
+  uint64_t next_seq_ = 0;
+  uint64_t respawns_ = 0;
+  bool stop_ = false;
+  /// A pipe to wake the reader when stopping
+  int wake_[2] = {-1, -1};
+  /// The thread reading results and watching for dead workers
+  std::thread reader_;
+  /// The resends waiting for the sender
+  std::deque<resend_job> resends_;
+  std::condition_variable resend_cv_;
+  /// The thread resending requests, so the reader keeps reading results while a resend waits on a full socket
+  std::thread sender_;
+  std::mutex lock_;
+
+  /**
+   * @brief Forks a new worker, must hold lock_ once the reader is running
+   * @return shared_ptr<worker> - The worker, or nullptr if it couldn't be started
+   */
+  std::shared_ptr<worker> _spawn();
+  /**
+   * @brief The loop a worker process runs until its socket closes
+   * @param fd int - The socket to the parent
+   * @param shm shm_header* - The worker's shared memory
+   * @param types unordered_map<string, task_fn> - The task types
+   */
+  void _serve(int fd, shm_header *shm, const std::unordered_map<std::string, task_fn> &types);
+  /**
+   * @brief Reads results from every worker, respawning the ones that die
+   */
+  void _read();
+  /**
+   * @brief Handles every full response frame in a worker's inbox
+   * @param w worker - The worker
+   */
+  void _handle(const std::shared_ptr<worker> &w);
+  /**
+   * @brief Replaces a dead worker and sends it the requests the old one hadn't started
+   *
+   * If no new worker can be started, the dead one is dropped and its requests fail with SPAWN_FAILED.
+   * @param old worker - The dead worker
+   */
+  void _respawn(const std::shared_ptr<worker> &old);
+  /**
+   * @brief Sends the requests in resends_ until stopped
+   */
+  void _resend();
+  /**
+   * @brief Writes a request to a worker, if it's still alive
+   */
+  void _send(const std::shared_ptr<worker> &w, uint64_t seq, const request &req);
+
+  static bool _read_full(int fd, void *buf, size_t len);
+  static bool _write_full(int fd, const void *buf, size_t len);
+  static void _free(const std::shared_ptr<worker> &w, size_t ring_size);
+
+ public:
+  /**
+   * @brief Makes a pool of worker processes
+   * @param workers int - The amount of worker processes
+   * @param ring_size size_t - The bytes of shared memory each worker writes results into
+   */
+  explicit process_pool(int workers, size_t ring_size = 1 << 20);
+  /// stops and reaps every worker, failing what they didn't finish
+  ~process_pool();
+
+  process_pool(process_pool &other) = delete;
+  void operator=(const process_pool &) = delete;
+
+  /**
+   * @brief Sends a task to the least busy worker
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @param done function - Called from the reader thread with the result
+   */
+  void submit(const std::string &type, const std::string &args, std::function<void(const retype &)> done);
+
+  /**
+   * @brief Sends a task to the least busy worker
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @return future<retype> - The result
+   */
+  std::future<retype> submit(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Makes a task function that runs on this pool, for use with task_manager::add
+   * @param type string - The registered type of the task
+   * @param args string - The serialized arguments
+   * @return function<retype()> - The function, which waits for the result in a blocking_region
+   */
+  std::function<retype()> remote(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Gets how many times a worker has been respawned
+   * @return uint64_t - The amount of respawns
+   */
+  uint64_t respawns();
+
+  /**
+   * @brief Gets the process IDs of the workers
+   * @return vector<pid_t> - The process IDs
+   */
+  std::vector<pid_t> pids();
+};
+
+inline process_pool::process_pool(int workers, size_t ring_size) : ring_size_(ring_size) {
+  if (pipe(wake_) != 0) wake_[0] = wake_[1] = -1;
+  for (int i = 0; i < workers; ++i) {
+    if (auto w = _spawn()) workers_.push_back(w);
+  }
+  reader_ = std::thread(&process_pool::_read, this);
+  sender_ = std::thread(&process_pool::_resend, this);
+}
+
+inline process_pool::~process_pool() {
+  {
+    GUARD(lock_);
+    stop_ = true;
+  }
+  resend_cv_.notify_all();
+  char c = 0;
+  if (write(wake_[1], &c, 1) < 0) {}
+  reader_.join();
+  close(wake_[0]);
+  close(wake_[1]);
+
+  // first, so a resend stuck on a full socket fails and the sender can stop
+  for (auto &w: workers_) {
+    if (w->pid > 0) kill(w->pid, SIGKILL);
+  }
+  sender_.join();
+
+  for (auto &w: workers_) {
+    {
+      GUARD(w->write_lock);
+      w->dead = true;
+      if (w->fd >= 0) close(w->fd);
+      w->fd = -1;
+    }
+    if (w->pid > 0) waitpid(w->pid, nullptr, 0);
+    for (auto &[seq, req]: w->pending) req->done({"", WORKER_DIED});
+    _free(w, ring_size_);
+  }
+}
+
+inline std::shared_ptr<process_pool::worker> process_pool::_spawn() {
+  auto w = std::make_shared<worker>();
+  void *mem = mmap(nullptr, sizeof(shm_header) + ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  w->shm = new(mem) shm_header();
+  w->shm->running = IDLE;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    _free(w, ring_size_);
+    return nullptr;
+  }
+  // copied before forking, the registry's lock may be held by another thread
+  auto types = task_registry::get_instance()->types();
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    _free(w, ring_size_);
+    return nullptr;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    close(wake_[0]);
+    close(wake_[1]);
+    // the sockets of the other workers, or they would never see their parent close them
+    for (auto &other: workers_) {
+      if (!other->dead && other->fd >= 0) close(other->fd);
+    }
+    _serve(fds[1], w->shm, types);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  w->pid = pid;
+  w->fd = fds[0];
+  return w;
+}
+
+inline void process_pool::_serve(int fd, shm_header *shm, const std::unordered_map<std::string, task_fn> &types) {
+  char *ring = reinterpret_cast<char *>(shm + 1);
+  uint64_t produced = 0;
+  request_header in{};
+  std::string type, args;
+
+  while (_read_full(fd, &in, sizeof(in))) {
+    type.resize(in.type_len);
+    args.resize(in.args_len);
+    if (!_read_full(fd, type.data(), type.size()) || !_read_full(fd, args.data(), args.size())) break;
+
+    shm->running.store(in.seq, std::memory_order_release);
+    auto it = types.find(type);
+    retype result = it == types.end() ? retype{"", UNKNOWN_TYPE} : it->second(args);
+
+    response_header out{in.seq, result.err, 0, 0, result.ret.size(), 0};
+    uint64_t pos = produced % ring_size_;
+    uint64_t advance = pos + out.len > ring_size_ ? ring_size_ - pos + out.len : out.len;
+    if (out.len > 0 && produced + advance - shm->consumed.load(std::memory_order_acquire) <= ring_size_) {
+      out.in_shm = 1;
+      out.offset = pos + out.len > ring_size_ ? 0 : pos;
+      out.advance = advance;
+      memcpy(ring + out.offset, result.ret.data(), out.len);
+      produced += advance;
+    }
+
+    shm->running.store(IDLE, std::memory_order_release);
+    if (!_write_full(fd, &out, sizeof(out))) break;
+    if (!out.in_shm && !_write_full(fd, result.ret.data(), out.len)) break;
+  }
+  close(fd);
+}
+
+inline void process_pool::_read() {
+  std::vector<pollfd> fds;
+  std::vector<std::shared_ptr<worker>> ws;
+  char buf[1 << 16];
+
+  while (true) {
+    {
+      GUARD(lock_);
+      if (stop_) return;
+      ws = workers_;
+    }
+    fds.clear();
+    for (auto &w: ws) fds.push_back({w->fd, POLLIN, 0});
+    fds.push_back({wake_[0], POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+    for (size_t i = 0; i < ws.size(); ++i) {
+      if (!fds[i].revents) continue;
+      ssize_t n = recv(ws[i]->fd, buf, sizeof(buf), 0);
+      if (n > 0) {
+        ws[i]->inbox.append(buf, n);
+        _handle(ws[i]);
+      } else if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      } else {
+        _respawn(ws[i]);
+      }
+    }
+  }
+}
+
+inline void process_pool::_handle(const std::shared_ptr<worker> &w) {
+  char *ring = reinterpret_cast<char *>(w->shm + 1);
+  while (w->inbox.size() >= sizeof(response_header)) {
+    response_header h{};
+    memcpy(&h, w->inbox.data(), sizeof(h));
+    size_t frame = sizeof(h) + (h.in_shm ? 0 : h.len);
+    if (w->inbox.size() < frame) return;
+
+    retype result{"", h.err};
+    if (h.in_shm) {
+      result.ret.assign(ring + h.offset, h.len);
+      w->shm->consumed.fetch_add(h.advance, std::memory_order_release);
+    } else {
+      result.ret.assign(w->inbox.data() + sizeof(h), h.len);
+    }
+    w->inbox.erase(0, frame);
+
+    std::shared_ptr<request> req;
+    {
+      GUARD(lock_);
+      auto it = w->pending.find(h.seq);
+      if (it == w->pending.end()) continue;
+      req = it->second;
+      w->pending.erase(it);
+    }
+    req->done(result);
+  }
+}
+
+inline void process_pool::_respawn(const std::shared_ptr<worker> &old) {
+  {
+    GUARD(old->write_lock);
+    old->dead = true;
+    close(old->fd);
+    old->fd = -1;
+  }
+  waitpid(old->pid, nullptr, 0);
+  old->pid = -1;
+  uint64_t crashed = old->shm->running.load(std::memory_order_acquire);
+
+  std::shared_ptr<worker> fresh;
+  std::shared_ptr<request> failed;
+  // taken with the move, a submit to the fresh worker after it sends its own request
+  std::map<uint64_t, std::shared_ptr<request>> resend;
+  bool stopping;
+  {
+    GUARD(lock_);
+    stopping = stop_;
+    if (stopping) {
+      // the destructor skips a worker that's already closed and reaped, so what it had fails here
+      resend.swap(old->pending);
+    } else {
+      auto it = std::find(workers_.begin(), workers_.end(), old);
+      fresh = _spawn();
+      if (fresh) {
+        *it = fresh;
+        respawns_++;
+      } else {
+        workers_.erase(it);
+      }
+      for (auto &[seq, req]: old->pending) {
+        if (seq == crashed) failed = req;
+        else resend[seq] = req;
+      }
+      old->pending.clear();
+      if (fresh) fresh->pending = resend;
+    }
+  }
+  if (stopping) {
+    for (auto &[seq, req]: resend) req->done({"", WORKER_DIED});
+    return;
+  }
+
+  _free(old, ring_size_);
+
+  if (failed) failed->done({"", WORKER_DIED});
+  if (!fresh) {
+    for (auto &[seq, req]: resend) req->done({"", SPAWN_FAILED});
+    return;
+  }
+  {
+    GUARD(lock_);
+    resends_.push_back({fresh, std::move(resend)});
+  }
+  resend_cv_.notify_one();
+}
+
+inline void process_pool::_resend() {
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    resend_cv_.wait(guard, [this]() { return stop_ || !resends_.empty(); });
+    if (stop_) return;
+    resend_job job = std::move(resends_.front());
+    resends_.pop_front();
+    guard.unlock();
+    for (auto &[seq, req]: job.requests) _send(job.to, seq, *req);
+    guard.lock();
+  }
+}
+
+inline void process_pool::_send(const std::shared_ptr<worker> &w, uint64_t seq, const request &req) {
+  std::string frame(sizeof(request_header), '\0');
+  request_header h{seq, (uint32_t) req.type.size(), (uint32_t) req.args.size()};
+  memcpy(frame.data(), &h, sizeof(h));
+  frame += req.type;
+  frame += req.args;
+
+  GUARD(w->write_lock);
+  // if the worker died, the reader hands this request to its replacement
+  if (w->dead) return;
+  _write_full(w->fd, frame.data(), frame.size());
+}
+
+inline bool process_pool::_read_full(int fd, void *buf, size_t len) {
+  char *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline bool process_pool::_write_full(int fd, const void *buf, size_t len) {
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+inline void process_pool::_free(const std::shared_ptr<worker> &w, size_t ring_size) {
+  w->shm->~shm_header();
+  munmap(w->shm, sizeof(shm_header) + ring_size);
+  w->shm = nullptr;
+}
+
+inline void process_pool::submit(const std::string &type,
+                                 const std::string &args,
+                                 std::function<void(const retype &)> done) {
+  auto req = std::make_shared<request>(request{type, args, std::move(done)});
+  std::shared_ptr<worker> w;
+  uint64_t seq;
+  {
+    GUARD(lock_);
+    if (workers_.empty()) {
+      req->done({"", SPAWN_FAILED});
+      return;
+    }
+    w = *std::min_element(workers_.begin(), workers_.end(), [](const auto &a, const auto &b) {
+      return a->pending.size() < b->pending.size();
+    });
+    seq = next_seq_++;
+    w->pending[seq] = req;
+  }
+  _send(w, seq, *req);
+}
+
+inline std::future<retype> process_pool::submit(const std::string &type, const std::string &args) {
+  auto promise = std::make_shared<std::promise<retype>>();
+  auto future = promise->get_future();
+  submit(type, args, [promise](const retype &r) { promise->set_value(r); });
+  return future;
+}
+
+inline std::function<retype()> process_pool::remote(const std::string &type, const std::string &args) {
+  return [this, type, args]() {
+    auto result = submit(type, args);
+    // the worker only waits here, so the task manager can start another while compensating
+    blocking_region blocking;
+    return result.get();
+  };
+}
+
+inline uint64_t process_pool::respawns() {
+  GUARD(lock_);
+  return respawns_;
+}
+
+inline std::vector<pid_t> process_pool::pids() {
+  std::vector<pid_t> out;
+  GUARD(lock_);
+  for (auto &w: workers_) out.push_back(w->pid);
+  return out;
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_PROCESS_POOL_H_
@@ -0,0 +1,135 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_REGISTRY_H_
+#define TASK_MANAGER_SRC_REGISTRY_H_
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "task_manager.h"
+
+namespace unmined {
+
+/**
+ * @brief The errors returned by tasks that are run from a type name
+ */
+enum task_errors {
+  /// The type of the task was never registered
+  UNKNOWN_TYPE = -100,
+  /// The process running the task died while running it
+  WORKER_DIED = -101,
+  /// No process could be started to run the task
+  SPAWN_FAILED = -102,
+};
+
+/**
+ * @brief A function that can be run from its serialized arguments
+ */
+using task_fn = std::function<retype(const std::string &args)>;
+
+/**
+ * @brief The registry of task types, so that a task can be described by a type name and its arguments
+ */
+class task_registry {
+ private:
+  /// The singleton instance
+  static inline task_registry *instance_ = nullptr;
+
+  /// The functions by type name
+  std::unordered_map<std::string, task_fn> types_;
+  std::mutex types_lock_;
+
+  task_registry() = default;
+
+ public:
+  /// you can't use this
+  task_registry(task_registry &other) = delete;
+  /// you can't use this
+  void operator=(const task_registry &) = delete;
+
+  /**
+   * @brief Gets the instance of the registry
+   * @return task_registry* - The registry instance
+   */
+  static task_registry *get_instance();
+
+  /**
+   * @brief Registers a task type, replacing any with the same name
+   * @param type string - The name of the type
+   * @param fn task_fn - The function run for the type
+   */
+  void add(const std::string &type, task_fn fn);
+
+  /**
+   * @brief Checks if a task type is registered
+   * @param type string - The name of the type
+   * @return bool - If the type is registered
+   */
+  bool has(const std::string &type);
+
+  /**
+   * @brief Gets a copy of every registered type
+   * @return unordered_map<string, task_fn> - The functions by type name
+   */
+  std::unordered_map<std::string, task_fn> types();
+
+  /**
+   * @brief Runs a task type with its arguments
+   * @param type string - The name of the type
+   * @param args string - The serialized arguments
+   * @return retype - The result, or UNKNOWN_TYPE if the type isn't registered
+   */
+  retype run(const std::string &type, const std::string &args);
+
+  /**
+   * @brief Makes a task that runs a task type with its arguments
+   * @param name string - The name of the task
+   * @param type string - The name of the type
+   * @param args string - The serialized arguments
+   * @return task - The task, with default settings
+   */
+  task make(const std::string &name, const std::string &type, const std::string &args);
+};
+
+inline task_registry *task_registry::get_instance() {
+  static std::once_flag once;
+  std::call_once(once, []() { instance_ = new task_registry(); });
+  return instance_;
+}
+
+inline void task_registry::add(const std::string &type, task_fn fn) {
+  GUARD(types_lock_);
+  types_[type] = std::move(fn);
+}
+
+inline bool task_registry::has(const std::string &type) {
+  GUARD(types_lock_);
+  return types_.contains(type);
+}
+
+inline std::unordered_map<std::string, task_fn> task_registry::types() {
+  GUARD(types_lock_);
+  return types_;
+}
+
+inline retype task_registry::run(const std::string &type, const std::string &args) {
+  task_fn fn;
+  {
+    GUARD(types_lock_);
+    auto it = types_.find(type);
+    if (it == types_.end()) return {"", UNKNOWN_TYPE};
+    fn = it->second;
+  }
+  return fn(args);
+}
+
+inline task task_registry::make(const std::string &name, const std::string &type, const std::string &args) {
+  return {name, [this, type, args]() { return run(type, args); }};
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_REGISTRY_H_
@@ -0,0 +1,105 @@
+//
+// Created by christian on 10/19/26.
+//
+
+#ifndef TASK_MANAGER_SRC_REPLAY_H_
+#define TASK_MANAGER_SRC_REPLAY_H_
+
+#include <algorithm>
+#include <set>
+#include "capture.h"
+#include "task_manager.h"
+
+namespace unmined {
+
+/**
+ * @brief The outcome of replay
+ */
+struct replay_report {
+  /// The tasks re-submitted
+  uint64_t tasks = 0;
+  /// The wall time from the first submit to the last task finishing
+  std::chrono::nanoseconds makespan{0};
+  /// The pools seen in the capture
+  std::vector<std::string> pools;
+};
+
+/**
+ * @brief Makes a task that stands in for a captured one, using the same CPU time, then waiting out the rest of its wall
+ * time, and returning a result of the same size
+ * @param r capture_record - The captured task
+ * @param speed double - How many times faster than captured to run
+ * @return task - The task, with the captured name, POOL and AFTER
+ */
+inline task synthetic_task(const capture_record &r, double speed) {
+  auto cpu = std::chrono::nanoseconds((int64_t) ((double) r.cpu / speed));
+  auto wall = std::chrono::nanoseconds((int64_t) ((double) r.runtime / speed));
+  uint64_t size = r.result_size;
+  return {r.name,
+          [cpu, wall, size]() {
+            auto start = std::chrono::steady_clock::now();
+            timespec now{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            auto until = std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec) + cpu;
+            do {
+              clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            } while (std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec) < until);
+            std::this_thread::sleep_until(start + wall);
+            return retype{std::string(size, 'x'), 0};
+          },
+          {
+              {AFTER, r.after},
+              {POOL, r.pool},
+          }};
+}
+
+/**
+ * @brief Re-submits a captured workload as synthetic tasks with the same timing, pools and AFTER dependencies
+ *
+ * This uses up the task_manager<WORKER_COUNT, HOOKS> instance, it's started, and joined once everything has run.
+ * Turn on TRACK_USAGE first to get the queue waits and usage of each pool afterwards. Tasks the records are after that
+ * aren't in them are marked as done.
+ * @tparam WORKER_COUNT The amount of workers to replay with
+ * @param tm task_manager - The task manager to replay on
+ * @param records vector<capture_record> - The captured tasks, see read_capture
+ * @param speed double - How many times faster than captured to submit and run, default 1
+ * @return replay_report - How long it took
+ */
+template<int WORKER_COUNT, typename HOOKS>
+replay_report replay(task_manager<WORKER_COUNT, HOOKS> *tm, std::vector<capture_record> records, double speed = 1) {
+  replay_report report;
+  if (speed <= 0) speed = 1;
+  std::stable_sort(records.begin(), records.end(), [](const capture_record &a, const capture_record &b) {
+    return a.submitted < b.submitted;
+  });
+
+  // a capture started mid run has tasks after ones that ran before it, those count as done or they'd never run
+  std::set<std::string> names;
+  for (auto &r: records) names.insert(r.name);
+  for (auto &r: records) {
+    if (!r.after.empty() && !names.contains(r.after)) tm->mark_done(r.after);
+  }
+
+  std::set<std::string> pools;
+  int64_t first = records.empty() ? 0 : records.front().submitted;
+  auto start = std::chrono::steady_clock::now();
+  tm->set(KILL_ON_EMPTY, false);
+  tm->start();
+  for (auto &r: records) {
+    std::this_thread::sleep_until(start + std::chrono::nanoseconds((int64_t) ((double) (r.submitted - first) / speed)));
+    tm->add(synthetic_task(r, speed));
+    pools.insert(r.pool);
+    report.tasks++;
+  }
+  // only now, or the workers would stop whenever they caught up with the submits
+  tm->set(KILL_ON_EMPTY, true);
+  tm->join();
+
+  report.makespan = std::chrono::steady_clock::now() - start;
+  report.pools.assign(pools.begin(), pools.end());
+  return report;
+}
+
+}
+
+#endif //TASK_MANAGER_SRC_REPLAY_H_
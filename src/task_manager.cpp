@@ -5,28 +5,34 @@
 #include <thread>
 #include <iostream>
 #include <future>
+#include <random>
+#include <set>
 #include "task_manager.h"
 #include "util.h"
+#include "channel.h"
 
 using millis = std::chrono::milliseconds;
 using namespace std::chrono_literals;
 
 // region singleton stuff
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT> *unmined::task_manager<WORKER_COUNT>::instance_ = nullptr;
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS> *unmined::task_manager<WORKER_COUNT, HOOKS>::instance_ = nullptr;
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT>::task_manager() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS>::task_manager() {
   main_thread_ = std::thread(&task_manager::_run, this);
 }
 
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT>::~task_manager() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS>::~task_manager() {
   pause();
-  GUARD(queue_lock_);
-  while (!queue_.empty()) {
-    queue_.pop_front();
+  {
+    GUARD(queue_lock_);
+    queue_.clear();
+    active_.clear();
+    for (auto &l: local_) l.clear();
+    queued_ = 0;
   }
   stop();
 }
@@ -37,125 +43,675 @@ unmined::task_manager<WORKER_COUNT>::~task_manager() {
  * @brief Runs the set amount of workers
  * @tparam WORKER_COUNT The amount of workers the task manager allows
  */
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::_run() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_run() {
+  live_ = WORKER_COUNT;
   for (int i = 0; i < WORKER_COUNT; ++i) {
+    states_[i].running = true;
     workers_[i] = std::thread(&task_manager::_run_worker, this, i);
   }
-  for (int i = 0; i < WORKER_COUNT; ++i) {
-    workers_[i].join();
+  while (live_ > 0) {
+    // only the workers ending needs noticing without compensation
+    std::this_thread::sleep_for(_monitor() ? 1ms : 10ms);
+  }
+  for (int i = 0; i < MAX_WORKERS; ++i) {
+    if (workers_[i].joinable()) workers_[i].join();
+  }
+  // nothing else will be streamed, so readers can finish
+  GUARD(sink_lock_);
+  if (stream_) stream_->close();
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_monitor() {
+  GUARD(compensation_lock_);
+  if (compensation_cap_ == 0) {
+    compensation_target_ = 0;
+    return false;
+  }
+
+  int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+  int64_t threshold = std::chrono::nanoseconds(block_threshold_).count();
+  int blocked = 0;
+  for (int i = 0; i < MAX_WORKERS; ++i) {
+    if (i >= WORKER_COUNT && !states_[i].running) continue;
+    int64_t since = states_[i].busy_since.load(std::memory_order_relaxed);
+    if (states_[i].blocking.load(std::memory_order_relaxed) > 0
+        || (threshold > 0 && since != 0 && now - since > threshold))
+      blocked++;
   }
+  compensation_target_ = std::min(blocked, compensation_cap_);
+
+  bool waiting;
+  {
+    GUARD(queue_lock_);
+    waiting = queued_ > 0;
+  }
+  if (!waiting || util::get(stop_, kill_lock_)) return true;
+
+  for (int i = WORKER_COUNT; i < MAX_WORKERS && compensating_ < compensation_target_; ++i) {
+    if (states_[i].running) continue;
+    // a retired compensation worker that hasn't been joined yet
+    if (workers_[i].joinable()) workers_[i].join();
+    states_[i].running = true;
+    compensating_++;
+    compensation_stats_.spawned++;
+    compensation_stats_.peak = std::max(compensation_stats_.peak, (uint64_t) compensating_);
+    workers_[i] = std::thread(&task_manager::_run_worker, this, i);
+  }
+  return true;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_retire() {
+  GUARD(compensation_lock_);
+  if (compensating_ <= compensation_target_) return false;
+  compensating_--;
+  compensation_stats_.retired++;
+  return true;
 }
 
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::_run_worker(int id) {
-  worker_start_callback(id);
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_run_worker(int id) {
+  detail::current_worker = id;
+  detail::current_blocking = &states_[id].blocking;
+  HOOK(on_worker_start, id);
 
+  bool retired = false;
+  // set when a task wasn't ready, so a worker doesn't keep taking it back off its own queue
+  bool skip_local = false;
   while (!util::get(stop_, kill_lock_)) {
+    if (id >= WORKER_COUNT && (retired = _retire())) break;
     if (util::get(is_paused_, is_paused_lock_)) continue;
-    struct task task = _pop_queue();
+    struct task task = _pop_queue(id, skip_local);
     if (!task.func) {
-      if (get(KILL_ON_EMPTY)) break;
+      // tasks may be left on other workers' queues that this one can't steal yet
+      if (get(KILL_ON_EMPTY) && is_done()) break;
       continue;
     }
 
-    std::string after = task.settings[AFTER];
-    if (!after.empty()) {
-      if (!util::has(util::get(done_, done_lock_), after)) {
+    skip_local = !_ready(task);
+    if (skip_local) continue;
+    if (get(TRACK_USAGE)) {
+      GUARD(stats_lock_);
+      waits_[task.settings[POOL]].add(std::chrono::steady_clock::now() - task.queued);
+    }
+    states_[id].busy_since.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    retype result = _start(task, id);
+    states_[id].busy_since.store(0, std::memory_order_relaxed);
+    _complete(task, result, id);
+  }
+  HOOK(on_worker_stop, id);
+  detail::storage.clear();
+  detail::current_worker = -1;
+  detail::current_blocking = nullptr;
+  if (id < WORKER_COUNT) {
+    states_[id].running = false;
+    live_--;
+    return;
+  }
+  GUARD(compensation_lock_);
+  if (!retired) {
+    compensating_--;
+    compensation_stats_.retired++;
+  }
+  states_[id].running = false;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::_ready(task &task) {
+  std::string after = task.settings[AFTER];
+  if (after.empty()) return true;
+  {
+    GUARD(done_lock_);
+    auto it = done_.find(after);
+    if (it != done_.end()) {
+      auto ref = refs_.find(after);
+      if (ref != refs_.end() && --ref->second == 0) {
+        refs_.erase(ref);
+        // it was only kept for this task
+        if (it->second == 0) done_.erase(it);
+      }
+      return true;
+    }
+  }
+  _push(task); // TODO: rework this, its garbo
+  return false;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_done(const std::string &name) {
+  done_[name]++;
+  if (done_limit_ == 0) return;
+  done_order_.push_back(name);
+  while (done_order_.size() > done_limit_) {
+    auto it = done_.find(done_order_.front());
+    done_order_.pop_front();
+    if (--it->second == 0 && !refs_.contains(it->first)) done_.erase(it);
+  }
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::retype unmined::task_manager<WORKER_COUNT, HOOKS>::_start(task &task, int id) {
+  HOOK(on_task_start, task, id);
+  bool track = get(TRACK_USAGE);
+  bool capturing = capturing_.load(std::memory_order_relaxed);
+  thread_usage before;
+  if (track || capturing) before = util::usage();
+  retype result = task.func();
+  if (track || capturing) {
+    thread_usage after = util::usage();
+    if (track) {
+      GUARD(stats_lock_);
+      pool_stats_[task.settings[POOL]].add(before, after);
+      worker_stats_[id].add(before, after);
+    }
+    if (capturing) _capture(task, result, after.wall - before.wall, after.cpu - before.cpu);
+  }
+  if (result.err < 0) HOOK(on_task_fail, task, id, result.err);
+  return result;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_complete(task &task, const retype &result, int id) {
+  std::vector<struct task> attached;
+  std::string key = task.settings[KEY];
+  if (!key.empty()) {
+    GUARD(keys_lock_);
+    attached = std::move(in_flight_[key]);
+    in_flight_.erase(key);
+    if (result.err >= 0) results_.put(key, result);
+  }
+  _finish(task, result);
+  HOOK(on_task_stop, task, id);
+  // the tasks that joined the key finish with its result, as if they had run it
+  for (auto &t: attached) {
+    _capture(t, result);
+    _finish(t, result);
+    if (result.err < 0) HOOK(on_task_fail, t, id, result.err);
+    HOOK(on_task_stop, t, id);
+  }
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_capture(task &task,
+                                                          const retype &result,
+                                                          std::chrono::nanoseconds wall,
+                                                          std::chrono::nanoseconds cpu) {
+  if (!capturing_.load(std::memory_order_relaxed)) return;
+  GUARD(capture_lock_);
+  if (!capture_) return;
+  capture_->write({std::chrono::duration_cast<std::chrono::nanoseconds>(task.queued - capture_start_).count(),
+                   (uint64_t) wall.count(),
+                   (uint64_t) cpu.count(),
+                   result.ret.size(),
+                   task.name,
+                   task.settings[POOL],
+                   task.settings[AFTER]});
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::sim_report unmined::task_manager<WORKER_COUNT, HOOKS>::simulate(uint64_t seed,
+                                                                          std::function<std::chrono::nanoseconds(const task &)> cost) {
+  using nanos = std::chrono::nanoseconds;
+  struct running {
+    nanos end;
+    uint64_t tiebreak;
+    int wid;
+    struct task task;
+    retype result;
+    nanos start;
+  };
+  auto later = [](const running &a, const running &b) {
+    return a.end != b.end ? a.end > b.end : a.tiebreak > b.tiebreak;
+  };
+
+  pause();
+  {
+    GUARD(queue_lock_);
+    simulating_ = true;
+  }
+  std::mt19937_64 rng(seed);
+  std::priority_queue<running, std::vector<running>, decltype(later)> events(later);
+  std::array<bool, WORKER_COUNT> busy{};
+  // the worker_local values of each virtual worker, since they all run on this thread
+  std::array<detail::local_storage, WORKER_COUNT> storages;
+  std::array<int, WORKER_COUNT> order{};
+  for (int i = 0; i < WORKER_COUNT; ++i) order[i] = i;
+  sim_report report;
+
+  while (true) {
+    // every idle worker tries to take a task at this instant, in an order picked by the seed
+    std::shuffle(order.begin(), order.end(), rng);
+    // the tasks found not ready at this instant, by pool and ID
+    std::set<std::pair<std::string, int>> not_ready;
+    for (int wid: order) {
+      if (busy[wid]) continue;
+      bool skip_local = false;
+      while (true) {
+        size_t queued;
         {
           GUARD(queue_lock_);
-          queue_.push_back(task); // TODO: rework this, its garbo
+          queued = queued_;
         }
-        continue;
+        if (queued == 0 || not_ready.size() >= queued) break;
+        struct task task = _pop_queue(wid, skip_local);
+        if (!task.func) break;
+        if (!_ready(task)) {
+          report.requeues++;
+          // a task this worker already tried means it has nothing new to try
+          if (!not_ready.insert({task.settings[POOL], task.id}).second) break;
+          skip_local = true;
+          continue;
+        }
+        nanos took = cost ? cost(task) : task.settings[COST].empty() ? nanos(1ms) : nanos(std::stoll(task.settings[COST]));
+        detail::current_worker = wid;
+        detail::storage_override = &storages[wid];
+        retype result = _start(task, wid);
+        detail::storage_override = nullptr;
+        detail::current_worker = -1;
+        events.push({report.makespan + took, rng(), wid, task, result, report.makespan});
+        busy[wid] = true;
+        break;
       }
     }
 
-    task_start_callback(task, id);
-    auto [val, err] = task.func();
-    if (err < 0) task_fail_callback(task, id, err);
-    {
-      GUARD(done_lock_);
-      done_.push_back(task.name);
-    }
-    {
-      GUARD(pools_lock_);
-      pools_[task.settings[POOL]][task.id] = val;
-    }
-    task_stop_callback(task, id);
+    if (events.empty()) break;
+    // then the clock jumps to the next task to finish
+    running next = events.top();
+    events.pop();
+    report.makespan = next.end;
+    _complete(next.task, next.result, next.wid);
+    busy[next.wid] = false;
+    report.tasks++;
+    report.trace.push_back({next.task.name, next.wid, next.start, next.end});
   }
-  worker_stop_callback(id);
+
+  GUARD(queue_lock_);
+  simulating_ = false;
+  report.stuck = queued_;
+  return report;
 }
-template<int WORKER_COUNT>
-unmined::task_manager<WORKER_COUNT> *unmined::task_manager<WORKER_COUNT>::get_instance() {
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_manager<WORKER_COUNT, HOOKS> *unmined::task_manager<WORKER_COUNT, HOOKS>::get_instance() {
   if (instance_ == nullptr) instance_ = new task_manager();
   return instance_;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::add(task task) {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::add(task task) {
   {
     GUARD(pool_ntids_lock_);
     task.id = pool_ntIDs[task.settings[POOL]]++;
   }
+  task.queued = std::chrono::steady_clock::now();
+
+  std::string key = task.settings[KEY];
+  std::optional<retype> cached;
+  if (!key.empty()) {
+    GUARD(keys_lock_);
+    cached = results_.get(key);
+    auto it = in_flight_.find(key);
+    if (cached) {
+      cache_stats_.hits++;
+    } else if (it != in_flight_.end()) {
+      cache_stats_.joins++;
+      it->second.push_back(task);
+      return;
+    } else {
+      cache_stats_.misses++;
+      in_flight_[key];
+    }
+  }
+  // outside of keys_lock_, the sink may block
+  if (cached) {
+    _capture(task, *cached);
+    _finish(task, *cached);
+    return;
+  }
+
+  std::string after = task.settings[AFTER];
+  if (!after.empty()) {
+    GUARD(done_lock_);
+    refs_[after]++;
+  }
+  _push(task);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_push(task task) {
+  GUARD(queue_lock_);
+  queued_++;
+  std::string pool = task.settings[POOL];
+  auto [it, made] = queue_.try_emplace(pool);
+  pool_queue &q = it->second;
+  if (made) {
+    auto weight = weights_.find(pool);
+    q.name = pool;
+    q.weight = weight == weights_.end() ? 1 : weight->second;
+    active_.push_back(&q);
+  }
+
+  std::string affinity = task.settings[AFFINITY];
+  if (!affinity.empty()) {
+    auto &local = local_[std::hash<std::string>{}(affinity) % WORKER_COUNT];
+    if (local.size() < spill_limit_) {
+      q.local++;
+      local.push_back(std::move(task));
+      return;
+    }
+    affinity_stats_.spilled++;
+  }
+  q.tasks.push_back(std::move(task));
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::_finish(task &t, const retype &r) {
   {
-    GUARD(queue_lock_);
-    queue_.push_back(task);
+    GUARD(done_lock_);
+    _done(t.name);
   }
+  std::shared_ptr<result_sink> sink = util::get(sink_, sink_lock_);
+  if (!sink || get(KEEP_POOLS)) {
+    GUARD(pools_lock_);
+    pools_[t.settings[POOL]][t.id] = r.ret;
+  }
+  if (sink) (*sink)({t.name, t.settings[POOL], t.id, r});
+  if (t.finished) t.finished(r);
 }
 
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::start() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_sink(result_sink sink) {
+  GUARD(sink_lock_);
+  sink_ = sink ? std::make_shared<result_sink>(std::move(sink)) : nullptr;
+  if (stream_) stream_->close();
+  stream_ = nullptr;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::shared_ptr<unmined::channel<unmined::task_result>> unmined::task_manager<WORKER_COUNT, HOOKS>::stream(size_t capacity) {
+  auto out = make_channel<task_result>(capacity);
+  set_sink([out](task_result &&r) { out->push(std::move(r)); });
+  GUARD(sink_lock_);
+  stream_ = out;
+  return out;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::vector<std::pair<int, std::string>> unmined::task_manager<WORKER_COUNT, HOOKS>::drain(const std::string &pool,
+                                                                                             size_t max) {
+  std::vector<std::pair<int, std::string>> out;
+  GUARD(pools_lock_);
+  auto it = pools_.find(pool);
+  if (it == pools_.end()) return out;
+  auto &results = it->second;
+  while (!results.empty() && out.size() < max) {
+    auto node = results.extract(results.begin());
+    out.emplace_back(node.key(), std::move(node.mapped()));
+  }
+  if (results.empty()) pools_.erase(it);
+  return out;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::mark_done(const std::string &name) {
+  GUARD(done_lock_);
+  _done(name);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_done_limit(size_t limit) {
+  GUARD(done_lock_);
+  done_limit_ = limit;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_cache(size_t capacity, std::chrono::milliseconds ttl) {
+  GUARD(keys_lock_);
+  results_.resize(capacity, ttl);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::cache_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_cache_stats() {
+  GUARD(keys_lock_);
+  return cache_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_stats unmined::task_manager<WORKER_COUNT, HOOKS>::pool_stats(const std::string &pool) {
+  GUARD(stats_lock_);
+  auto it = pool_stats_.find(pool);
+  return it == pool_stats_.end() ? task_stats() : it->second;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task_stats unmined::task_manager<WORKER_COUNT, HOOKS>::worker_stats(int wid) {
+  GUARD(stats_lock_);
+  if (wid < 0 || wid >= MAX_WORKERS) return {};
+  return worker_stats_[wid];
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, unmined::task_stats> unmined::task_manager<WORKER_COUNT, HOOKS>::pools_stats() {
+  GUARD(stats_lock_);
+  return pool_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_weight(const std::string &pool, int weight) {
+  GUARD(queue_lock_);
+  weight = std::max(weight, 1);
+  weights_[pool] = weight;
+  auto it = queue_.find(pool);
+  if (it != queue_.end()) it->second.weight = weight;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+std::chrono::nanoseconds unmined::task_manager<WORKER_COUNT, HOOKS>::wait_percentile(const std::string &pool, double p) {
+  GUARD(stats_lock_);
+  auto it = waits_.find(pool);
+  return it == waits_.end() ? std::chrono::nanoseconds(0) : it->second.percentile(p);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_spill(size_t limit) {
+  GUARD(queue_lock_);
+  spill_limit_ = limit;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_steal(size_t backlog) {
+  GUARD(queue_lock_);
+  steal_backlog_ = backlog;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::affinity_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_affinity_stats() {
+  GUARD(queue_lock_);
+  return affinity_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::set_compensation(std::chrono::milliseconds threshold, int cap) {
+  GUARD(compensation_lock_);
+  block_threshold_ = threshold;
+  compensation_cap_ = std::clamp(cap, 0, WORKER_COUNT);
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+unmined::compensation_stats unmined::task_manager<WORKER_COUNT, HOOKS>::get_compensation_stats() {
+  GUARD(compensation_lock_);
+  return compensation_stats_;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::capture(const std::string &path) {
+  GUARD(capture_lock_);
+  capture_ = std::make_unique<capture_writer>(path);
+  if (!capture_->good()) {
+    capture_.reset();
+    capturing_ = false;
+    return false;
+  }
+  capture_start_ = std::chrono::steady_clock::now();
+  capturing_ = true;
+  return true;
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::stop_capture() {
+  GUARD(capture_lock_);
+  capturing_ = false;
+  capture_.reset();
+}
+
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::start() {
   GUARD(is_paused_lock_);
   is_paused_ = false;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::pause() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::pause() {
   GUARD(is_paused_lock_);
   is_paused_ = true;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::stop() {
-  GUARD(kill_lock_);
-  instance_ = nullptr;
-  stop_ = true;
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::stop() {
+  {
+    GUARD(kill_lock_);
+    instance_ = nullptr;
+    stop_ = true;
+  }
+  // a worker waiting on a full stream gives up its result, or it would never see stop_
+  GUARD(sink_lock_);
+  if (stream_) stream_->close();
 }
-template<int WORKER_COUNT>
-bool unmined::task_manager<WORKER_COUNT>::is_done() {
+template<int WORKER_COUNT, typename HOOKS>
+bool unmined::task_manager<WORKER_COUNT, HOOKS>::is_done() {
   GUARD(queue_lock_);
-  return queue_.empty();
+  return queued_ == 0;
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::join() {
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::join() {
   main_thread_.join();
 }
 
-template<int WORKER_COUNT>
-std::vector<std::string> unmined::task_manager<WORKER_COUNT>::tasks() {
+template<int WORKER_COUNT, typename HOOKS>
+std::vector<std::string> unmined::task_manager<WORKER_COUNT, HOOKS>::tasks() {
   std::vector<std::string> out;
-  for (auto &i: queue_) {
-    out.push_back(i.name);
+  GUARD(queue_lock_);
+  for (auto &l: local_) {
+    for (auto &i: l) {
+      out.push_back(i.name);
+    }
+  }
+  for (auto *q: active_) {
+    for (auto &i: q->tasks) {
+      out.push_back(i.name);
+    }
   }
   return out;
 }
-template<int WORKER_COUNT>
-unmined::task unmined::task_manager<WORKER_COUNT>::_pop_queue() {
+template<int WORKER_COUNT, typename HOOKS>
+unmined::task unmined::task_manager<WORKER_COUNT, HOOKS>::_pop_queue(int wid, bool skip_local) {
   GUARD(queue_lock_);
-  if (queue_.empty()) return task();
-  task t = queue_.front();
-  queue_.pop_front();
-  return t;
+  if (queued_ == 0) return task();
+
+  bool own = wid < WORKER_COUNT && !local_[wid].empty();
+  // takes the front of an affinity queue outside of its pool's turn
+  auto take_front = [&](std::deque<task> &from) {
+    task t = std::move(from.front());
+    from.pop_front();
+    queued_--;
+    auto it = queue_.find(t.settings[POOL]);
+    if (--it->second.local == 0 && it->second.tasks.empty()) {
+      active_.erase(std::find(active_.begin(), active_.end(), &it->second));
+      queue_.erase(it);
+    }
+    return t;
+  };
+  if (own && !skip_local && get(AFFINITY_FIRST)) {
+    affinity_stats_.local++;
+    return take_front(local_[wid]);
+  }
+
+  // deficit round robin, a pool starts its turn with its weight in tasks and passes once it has used them
+  for (size_t turns = active_.size(); turns > 0; --turns) {
+    pool_queue *q = active_.front();
+    bool local = false;
+    std::deque<task>::iterator mine;
+    if (own && !skip_local && q->local > 0) {
+      mine = std::find_if(local_[wid].begin(), local_[wid].end(), [&](task &t) { return t.settings[POOL] == q->name; });
+      local = mine != local_[wid].end();
+    }
+    if (!local && q->tasks.empty()) {
+      // what's left is queued for other workers, which take it in their turn or get it stolen
+      active_.pop_front();
+      active_.push_back(q);
+      continue;
+    }
+
+    if (q->deficit <= 0) q->deficit += q->weight;
+    q->deficit--;
+    queued_--;
+    task t;
+    if (local) {
+      t = std::move(*mine);
+      local_[wid].erase(mine);
+      q->local--;
+      affinity_stats_.local++;
+    } else {
+      t = std::move(q->tasks.front());
+      q->tasks.pop_front();
+    }
+
+    if (q->tasks.empty() && q->local == 0) {
+      active_.pop_front();
+      queue_.erase(queue_.find(q->name));
+    } else if (q->deficit <= 0) {
+      active_.pop_front();
+      active_.push_back(q);
+    }
+    return t;
+  }
+
+  // only from a worker that's behind, so a key doesn't move between workers whenever one is idle
+  size_t backlog = wid < WORKER_COUNT ? steal_backlog_ : 0;
+  std::deque<task> *victim = nullptr;
+  for (int i = 0; i < WORKER_COUNT; ++i) {
+    if (i == wid || local_[i].empty()) continue;
+    // the virtual workers of simulate are all running
+    if (local_[i].size() <= backlog && (simulating_ || states_[i].running)) continue;
+    if (!victim || local_[i].size() > victim->size()) victim = &local_[i];
+  }
+  if (victim) {
+    affinity_stats_.stolen++;
+    return take_front(*victim);
+  }
+  if (!own) return task();
+  affinity_stats_.local++;
+  return take_front(local_[wid]);
 }
-template<int WORKER_COUNT>
-void unmined::task_manager<WORKER_COUNT>::clear_pool(const std::string &pool) {
-  std::remove(pools_.begin(), pools_.end(), pools_.find(pool));
+template<int WORKER_COUNT, typename HOOKS>
+void unmined::task_manager<WORKER_COUNT, HOOKS>::clear_pool(const std::string &pool) {
+  GUARD(pools_lock_);
+  pools_.erase(pool);
 }
-template<int WORKER_COUNT>
-std::unordered_map<std::string, std::unordered_map<int, std::string>> unmined::task_manager<WORKER_COUNT>::pools() {
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, std::unordered_map<int, std::string>> unmined::task_manager<WORKER_COUNT, HOOKS>::pools() {
   GUARD(pools_lock_);
   return pools_;
 }
-template<int WORKER_COUNT>
-std::unordered_map<int, std::string> unmined::task_manager<WORKER_COUNT>::pool(const std::string &name) {
-  std::vector<std::string> out;
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<std::string, size_t> unmined::task_manager<WORKER_COUNT, HOOKS>::pool_sizes() {
+  std::unordered_map<std::string, size_t> out;
+  GUARD(pools_lock_);
+  for (auto &[name, results]: pools_) out[name] = results.size();
+  return out;
+}
+template<int WORKER_COUNT, typename HOOKS>
+std::unordered_map<int, std::string> unmined::task_manager<WORKER_COUNT, HOOKS>::pool(const std::string &name) {
   GUARD(pools_lock_);
-  return pools_[name];
+  auto it = pools_.find(name);
+  return it == pools_.end() ? std::unordered_map<int, std::string>() : it->second;
 }
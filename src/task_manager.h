@@ -14,11 +14,18 @@
 #include <queue>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <deque>
+#include "cache.h"
+#include "capture.h"
+#include "worker_local.h"
 
 #define GUARD(x) std::lock_guard<std::mutex> guard(x)
 #define EVAL(x, y) ((x & y) == (y))
 #define SET_ON(x, y) x |= y
 #define SET_OFF(x, y) x &= ~y
+/// Calls a hook of the HOOKS policy, or nothing if the policy doesn't have it
+#define HOOK(name, ...) if constexpr (requires { this->name(__VA_ARGS__); }) this->name(__VA_ARGS__)
 
 namespace unmined {
 
@@ -30,6 +37,12 @@ using namespace std::chrono_literals;
 enum tm_settings {
   KILL_ON_EMPTY = 1,
   IN_ORDER = 1 << 1,
+  /// Measures the CPU time, wall time and context switches of every task
+  TRACK_USAGE = 1 << 2,
+  /// Keeps results in their pools even when they're sent to a sink
+  KEEP_POOLS = 1 << 3,
+  /// Workers run the tasks queued for them by affinity before their pools' turns, ignoring the pool weights
+  AFFINITY_FIRST = 1 << 4,
 };
 
 /**
@@ -44,6 +57,18 @@ enum task_settings {
    * @brief The pool (vector) that the task should return to
    */
   POOL = 1,
+  /**
+   * @brief The key of the task, tasks with the same key share a single run and its result
+   */
+  KEY = 2,
+  /**
+   * @brief How long the task takes in simulate, in nanoseconds
+   */
+  COST = 3,
+  /**
+   * @brief Tasks with the same affinity prefer to run on the same worker
+   */
+  AFFINITY = 4,
   /// The ID of the task, will be overwritten by the task manager
   ID = -1,
 };
@@ -53,6 +78,200 @@ struct retype {
   int err;
 };
 
+/**
+ * @brief The counters for keyed tasks
+ */
+struct cache_stats {
+  /// Tasks that were given a cached result
+  uint64_t hits = 0;
+  /// Tasks that were attached to an in-flight task with the same key
+  uint64_t joins = 0;
+  /// Tasks that had to be run
+  uint64_t misses = 0;
+};
+
+namespace detail {
+/// The blocking counter of the worker the calling thread is, nullptr if it isn't one
+inline thread_local std::atomic<int> *current_blocking = nullptr;
+}
+
+/**
+ * @brief Marks the calling worker as blocked while it's in scope, so the task manager can run a compensation worker
+ *
+ * Does nothing when not on a worker.
+ */
+class blocking_region {
+ private:
+  std::atomic<int> *blocking_ = detail::current_blocking;
+
+ public:
+  blocking_region() {
+    if (blocking_) blocking_->fetch_add(1, std::memory_order_relaxed);
+  }
+  ~blocking_region() {
+    if (blocking_) blocking_->fetch_sub(1, std::memory_order_relaxed);
+  }
+  blocking_region(const blocking_region &) = delete;
+  void operator=(const blocking_region &) = delete;
+};
+
+/**
+ * @brief The counters for compensation workers
+ */
+struct compensation_stats {
+  /// Compensation workers started
+  uint64_t spawned = 0;
+  /// Compensation workers that stopped once the blocked workers came back
+  uint64_t retired = 0;
+  /// The most compensation workers running at once
+  uint64_t peak = 0;
+};
+
+/**
+ * @brief The counters for tasks with an affinity
+ */
+struct affinity_stats {
+  /// Tasks run by the worker their affinity maps to
+  uint64_t local = 0;
+  /// Tasks taken from another worker's queue by an idle worker
+  uint64_t stolen = 0;
+  /// Tasks sent to the shared queue because their worker had too many queued
+  uint64_t spilled = 0;
+};
+
+/**
+ * @brief The time and context switches used by a thread
+ */
+struct thread_usage {
+  /// The time passed
+  std::chrono::nanoseconds wall{0};
+  /// The time spent on the CPU
+  std::chrono::nanoseconds cpu{0};
+  /// The times the thread gave up the CPU, usually to wait on I/O or a lock
+  uint64_t voluntary_switches = 0;
+  /// The times the thread was taken off the CPU by the scheduler
+  uint64_t involuntary_switches = 0;
+};
+
+/**
+ * @brief The usage of the tasks run by a pool or a worker
+ */
+struct task_stats {
+  /// The amount of tasks run
+  uint64_t count = 0;
+  /// The usage of every task, summed
+  thread_usage total;
+  /// The longest wall time of a task
+  std::chrono::nanoseconds max_wall{0};
+  /// The longest CPU time of a task
+  std::chrono::nanoseconds max_cpu{0};
+
+  /**
+   * @brief Adds a task, from the usage sampled before and after it ran
+   * @param before thread_usage - The usage before the task
+   * @param after thread_usage - The usage after the task
+   */
+  void add(const thread_usage &before, const thread_usage &after) {
+    auto wall = after.wall - before.wall;
+    auto cpu = after.cpu - before.cpu;
+    count++;
+    total.wall += wall;
+    total.cpu += cpu;
+    total.voluntary_switches += after.voluntary_switches - before.voluntary_switches;
+    total.involuntary_switches += after.involuntary_switches - before.involuntary_switches;
+    max_wall = std::max(max_wall, wall);
+    max_cpu = std::max(max_cpu, cpu);
+  }
+
+  /**
+   * @brief Gets how much of the wall time was spent on the CPU, near 1 is CPU bound, near 0 is blocked on I/O
+   * @return double - The CPU time over the wall time
+   */
+  double cpu_ratio() const {
+    return total.wall.count() ? (double) total.cpu.count() / (double) total.wall.count() : 0;
+  }
+};
+
+/**
+ * @brief The last times tasks of a pool waited in the queue, kept with TRACK_USAGE
+ */
+struct wait_stats {
+  /// The amount of waits kept
+  static constexpr size_t KEPT = 1024;
+
+  /// The last KEPT waits, oldest overwritten first
+  std::vector<std::chrono::nanoseconds> samples;
+  /// Where the next wait goes once samples is full
+  size_t next = 0;
+
+  /**
+   * @brief Adds a wait
+   * @param wait nanoseconds - The time a task spent queued
+   */
+  void add(std::chrono::nanoseconds wait) {
+    if (samples.size() < KEPT) samples.push_back(wait);
+    else samples[next] = wait;
+    next = (next + 1) % KEPT;
+  }
+
+  /**
+   * @brief Gets a percentile of the kept waits
+   * @param p double - The percentile, from 0 to 100
+   * @return nanoseconds - The wait that p percent of the waits are at or under
+   */
+  std::chrono::nanoseconds percentile(double p) const {
+    if (samples.empty()) return std::chrono::nanoseconds(0);
+    auto sorted = samples;
+    size_t i = std::min(sorted.size() - 1, (size_t) (std::clamp(p, 0.0, 100.0) / 100.0 * (double) sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + (long) i, sorted.end());
+    return sorted[i];
+  }
+};
+
+/**
+ * @brief A task run by simulate, on the virtual clock
+ */
+struct sim_event {
+  std::string name;
+  int wid;
+  std::chrono::nanoseconds start;
+  std::chrono::nanoseconds end;
+};
+
+/**
+ * @brief The outcome of simulate
+ */
+struct sim_report {
+  /// The virtual time the last task finished at
+  std::chrono::nanoseconds makespan{0};
+  /// The amount of tasks run
+  uint64_t tasks = 0;
+  /// The times a task was put back because the task it's after wasn't done
+  uint64_t requeues = 0;
+  /// The tasks left in the queue that could never run
+  uint64_t stuck = 0;
+  /// Every task run, in the order they finished
+  std::vector<sim_event> trace;
+};
+
+/**
+ * @brief A finished task's result, as given to a result sink
+ */
+struct task_result {
+  std::string name;
+  std::string pool;
+  int id;
+  retype value;
+};
+
+/**
+ * @brief A function results are given to as tasks finish, called from the worker that ran the task
+ */
+using result_sink = std::function<void(task_result &&r)>;
+
+template<typename T>
+class channel;
+
 /**
  * @brief The task container, contains a name, a function, and settings
  */
@@ -64,50 +283,16 @@ struct task {
       {POOL, name},
   };
   int id = -1;
+  /// When the task was added to the queue
+  std::chrono::steady_clock::time_point queued{};
+  /// Called once the task's result is in its pool or sent to the sink, e.g. to record that it finished
+  std::function<void(const retype &)> finished{};
 };
 
 /**
- * @brief The task manager class
- * @tparam WORKER_COUNT The amount of worker threads, default 4
+ * @brief The default hooks, which call std::function callbacks that can be set at runtime
  */
-template<int WORKER_COUNT = 4>
-class task_manager {
- private:
-  /// The singleton instance
-  static task_manager<WORKER_COUNT> *instance_;
-
-  /// The main running thread, so that the main program can do other things
-  std::thread main_thread_;
-  /// The array of worker threads
-  std::array<std::thread, WORKER_COUNT> workers_;
-
-  /// The queue of tasks
-  std::deque<task> queue_;
-  /// A vector of the done tasks' names
-  std::vector<std::string> done_;
-  /// A map of the pools that functions can return to
-  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools_;
-  /// The next available task IDs for which pool
-  std::unordered_map<std::string, int> pool_ntIDs;
-  /// If the task manager is paused
-  bool is_paused_ = true;
-  /// If the task manager is stopped, will kill the task manager cleanly
-  bool stop_ = false;
-  /// The settings, only 2 exist, but there are 16 possible
-  uint16_t settings_ = 0 | (~KILL_ON_EMPTY | IN_ORDER);
-
-  // the mutexes for each variable that will be modified
-  std::mutex settings_lock_;
-  std::mutex is_paused_lock_;
-  std::mutex kill_lock_;
-  std::mutex done_lock_;
-  std::mutex queue_lock_;
-  std::mutex pools_lock_;
-  std::mutex pool_ntids_lock_;
-
- public:
-  // TODO: REWORK THIS, maybe make them private or sm
-
+struct callback_hooks {
   /**
    * @brief The function called when a task starts
    * @param t task - The task
@@ -142,6 +327,172 @@ class task_manager {
    */
   std::function<void(const int &wid)> worker_stop_callback = [](const int &wid) {};
 
+  void on_task_start(const task &t, int wid) { task_start_callback(t, wid); }
+  void on_task_stop(const task &t, int wid) { task_stop_callback(t, wid); }
+  void on_task_fail(const task &t, int wid, int err) { task_fail_callback(t, wid, err); }
+  void on_worker_start(int wid) { worker_start_callback(wid); }
+  void on_worker_stop(int wid) { worker_stop_callback(wid); }
+};
+
+/**
+ * @brief Hooks that do nothing, so the workers don't call anything around a task
+ */
+struct no_hooks {};
+
+namespace detail {
+/// Has a member named after every hook, so naming one through hook_probe is ambiguous when the policy has it too
+struct hook_names {
+  int on_task_start, on_task_stop, on_task_fail, on_worker_start, on_worker_stop;
+};
+
+template<typename HOOKS>
+struct hook_probe : HOOKS, hook_names {};
+}
+
+/// Fails to compile if the HOOKS policy has the hook, but it can't be called with the hook's arguments
+#define HOOK_CHECK(name, ...) \
+  static_assert(requires { &detail::hook_probe<HOOKS>::name; } \
+                    || requires(HOOKS &h, const task &t, int wid, int err) { h.name(__VA_ARGS__); }, \
+                "the HOOKS policy has " #name ", but it can't be called as " #name "(" #__VA_ARGS__ ")")
+
+/**
+ * @brief The task manager class
+ *
+ * The HOOKS policy is a base of the task manager, and can have any of on_task_start(const task &, int),
+ * on_task_stop(const task &, int), on_task_fail(const task &, int, int), on_worker_start(int) and
+ * on_worker_stop(int). The ones it has are called directly so they can inline, the ones it doesn't have aren't
+ * called at all. One it has that can't be called with those arguments doesn't compile.
+ * @tparam WORKER_COUNT The amount of worker threads, default 4
+ * @tparam HOOKS The hooks called around tasks and workers, default callback_hooks
+ */
+template<int WORKER_COUNT = 4, typename HOOKS = callback_hooks>
+class task_manager : public HOOKS {
+  HOOK_CHECK(on_task_start, t, wid);
+  HOOK_CHECK(on_task_stop, t, wid);
+  HOOK_CHECK(on_task_fail, t, wid, err);
+  HOOK_CHECK(on_worker_start, wid);
+  HOOK_CHECK(on_worker_stop, wid);
+
+ private:
+  /// The singleton instance
+  static task_manager *instance_;
+
+  /// The main running thread, so that the main program can do other things
+  std::thread main_thread_;
+  /// The most workers that can run at once, compensation workers included
+  static constexpr int MAX_WORKERS = WORKER_COUNT * 2;
+
+  /// What the monitor can see of a worker
+  struct alignas(64) worker_state {
+    /// When the current task started in steady clock nanoseconds, 0 if idle
+    std::atomic<int64_t> busy_since{0};
+    /// The amount of blocking_regions the worker is in
+    std::atomic<int> blocking{0};
+    /// If a worker is running in this slot
+    std::atomic<bool> running{false};
+  };
+
+  /// The array of worker threads, compensation workers after the first WORKER_COUNT
+  std::array<std::thread, MAX_WORKERS> workers_;
+  /// The state of each worker
+  std::array<worker_state, MAX_WORKERS> states_;
+  /// The amount of the first WORKER_COUNT workers still running
+  std::atomic<int> live_{0};
+  /// How long a task runs before its worker counts as blocked, 0 only counts blocking_regions
+  std::chrono::milliseconds block_threshold_{0};
+  /// The most compensation workers at once, 0 turns compensation off
+  int compensation_cap_ = 0;
+  /// The amount of compensation workers wanted right now
+  int compensation_target_ = 0;
+  /// The amount of compensation workers running
+  int compensating_ = 0;
+  /// The counters for compensation workers
+  struct compensation_stats compensation_stats_;
+
+  /// The queued tasks of one pool, with its place in the fair scheduling
+  struct pool_queue {
+    std::string name;
+    std::deque<task> tasks;
+    int weight = 1;
+    /// How many more tasks the pool can take this turn
+    int deficit = 0;
+    /// How many of the pool's tasks are queued for a worker by affinity instead
+    size_t local = 0;
+  };
+
+  /// The queues of tasks by pool, a pool's queue only exists while it has tasks
+  std::unordered_map<std::string, pool_queue> queue_;
+  /// The pools with tasks, in the order they take turns
+  std::deque<pool_queue *> active_;
+  /// The weights set with set_weight, other pools have a weight of 1
+  std::unordered_map<std::string, int> weights_;
+  /// The tasks queued for each worker by their affinity
+  std::array<std::deque<task>, WORKER_COUNT> local_;
+  /// How many tasks a worker can have queued by affinity before more go to the shared queue
+  size_t spill_limit_ = 1024;
+  /// How many tasks a worker has to have queued by affinity before idle workers steal from it
+  size_t steal_backlog_ = 16;
+  /// The counters for tasks with an affinity
+  struct affinity_stats affinity_stats_;
+  /// If simulate is running, so stealing doesn't depend on the state of the real workers
+  bool simulating_ = false;
+  /// The amount of tasks in every queue
+  size_t queued_ = 0;
+  /// The done tasks' names, with how many times each is in done_order_
+  std::unordered_map<std::string, size_t> done_;
+  /// The names of the last done_limit_ tasks to finish, oldest first, empty without a limit
+  std::deque<std::string> done_order_;
+  /// How many done names are kept for tasks added later, 0 for all of them, names queued tasks are after are kept either way
+  size_t done_limit_ = 0;
+  /// How many queued tasks are after each name
+  std::unordered_map<std::string, size_t> refs_;
+  /// A map of the pools that functions can return to
+  std::unordered_map<std::string, std::unordered_map<int, std::string>> pools_;
+  /// The next available task IDs for which pool
+  std::unordered_map<std::string, int> pool_ntIDs;
+  /// The keys of queued or running tasks, with the tasks waiting on their result
+  std::unordered_map<std::string, std::vector<task>> in_flight_;
+  /// The results of finished keyed tasks
+  lru_cache<std::string, retype> results_{1024};
+  /// The counters for keyed tasks
+  struct cache_stats cache_stats_;
+  /// The usage of the tasks by pool, only kept with TRACK_USAGE
+  std::unordered_map<std::string, task_stats> pool_stats_;
+  /// The last queue waits by pool, only kept with TRACK_USAGE
+  std::unordered_map<std::string, wait_stats> waits_;
+  /// The usage of the tasks by worker, only kept with TRACK_USAGE
+  std::array<task_stats, MAX_WORKERS> worker_stats_;
+  /// Where results go instead of their pools, if set
+  std::shared_ptr<result_sink> sink_;
+  /// The channel sink_ feeds, if it was set by stream
+  std::shared_ptr<channel<task_result>> stream_;
+  /// Where the tasks run are written to while capturing
+  std::unique_ptr<capture_writer> capture_;
+  /// When the capture started, submit times are from here
+  std::chrono::steady_clock::time_point capture_start_;
+  /// If capture_ is open, so the workers can check without capture_lock_
+  std::atomic<bool> capturing_{false};
+  /// If the task manager is paused
+  bool is_paused_ = true;
+  /// If the task manager is stopped, will kill the task manager cleanly
+  bool stop_ = false;
+  /// The settings, only 2 exist, but there are 16 possible
+  uint16_t settings_ = IN_ORDER;
+
+  // the mutexes for each variable that will be modified
+  std::mutex settings_lock_;
+  std::mutex is_paused_lock_;
+  std::mutex kill_lock_;
+  std::mutex done_lock_;
+  std::mutex queue_lock_;
+  std::mutex pools_lock_;
+  std::mutex pool_ntids_lock_;
+  std::mutex keys_lock_;
+  std::mutex stats_lock_;
+  std::mutex compensation_lock_;
+  std::mutex capture_lock_;
+  std::mutex sink_lock_;
+
  private:
   /// makes a new task manager, do not use this
   task_manager();
@@ -149,9 +500,19 @@ class task_manager {
   ~task_manager();
 
   /**
-   * @brief The run function that starts all the workers and main thread
+   * @brief The run function that starts all the workers, then watches them for blocking until they stop
    */
   void _run();
+  /**
+   * @brief Counts the blocked workers, and starts compensation workers for them while there are tasks waiting
+   * @return bool - If compensation is on
+   */
+  bool _monitor();
+  /**
+   * @brief Checks if a compensation worker should stop, and marks it as stopped if so
+   * @return bool - If there are more compensation workers than blocked workers
+   */
+  bool _retire();
   /**
    * @brief Starts a worker with an ID
    * @param id int - The ID of the worker
@@ -159,10 +520,70 @@ class task_manager {
   void _run_worker(int id);
 
   /**
-   * @brief Gets the first item in the queue, and removes it
-   * @return task - The first item in the queue
+   * @brief Gets the next task for a worker and removes it
+   *
+   * The pools take turns by their weight, and in its pool's turn the worker's own affinity queue comes first, a pool with
+   * only other workers' affinity tasks passes its turn. Then the worker steals from the longest affinity queue of another
+   * worker that's past the steal backlog or has stopped. With AFFINITY_FIRST the worker's own queue goes before the pools.
+   * @param wid int - The worker ID
+   * @param skip_local bool - If the worker's own queue goes last, after its front task wasn't ready
+   * @return task - The next task, or an empty task if there are none the worker can take
+   */
+  task _pop_queue(int wid, bool skip_local = false);
+
+  /**
+   * @brief Adds a task to the back of its affinity's worker queue, or of its pool's queue
+   * @param task task - The task
+   */
+  void _push(task task);
+
+  /**
+   * @brief Checks if a task can run now, putting it back in the queue if it can't
+   * @param task task - The task
+   * @return bool - If the task can run
+   */
+  bool _ready(task &task);
+
+  /**
+   * @brief Adds a name to the done names, dropping the oldest past done_limit_ (if set) that no queued task is after,
+   * must hold done_lock_
+   * @param name string - The name of the task
+   */
+  void _done(const std::string &name);
+
+  /**
+   * @brief Runs a task, with its callbacks
+   * @param task task - The task
+   * @param id int - The worker ID
+   * @return retype - The result of the task
+   */
+  retype _start(task &task, int id);
+
+  /**
+   * @brief Stores the result of a task that ran, and of any tasks waiting on it
+   * @param task task - The task
+   * @param result retype - The result of the task
+   * @param id int - The worker ID
+   */
+  void _complete(task &task, const retype &result, int id);
+
+  /**
+   * @brief Writes a task to the capture, if capturing
+   *
+   * Tasks that got their result from the cache or a task with the same key are written with no runtime.
+   * @param task task - The task
+   * @param result retype - The result of the task
+   * @param wall nanoseconds - The wall time the task ran for
+   * @param cpu nanoseconds - The CPU time the task ran for
    */
-  task _pop_queue();
+  void _capture(task &task, const retype &result, std::chrono::nanoseconds wall = {}, std::chrono::nanoseconds cpu = {});
+
+  /**
+   * @brief Gives the result of a task to the sink or stores it in its pool, and marks it as done
+   * @param t task - The task
+   * @param r retype - The result of the task
+   */
+  void _finish(task &t, const retype &r);
 
  public:
   /// you can't use this
@@ -220,7 +641,7 @@ class task_manager {
     GUARD(settings_lock_);
     if (val) SET_ON(settings_, t);
     else
-      SET_OFF(settings_, ~t);
+      SET_OFF(settings_, t);
   }
 
   /**
@@ -229,11 +650,172 @@ class task_manager {
    * @return bool - The value of the setting (true or false)
    */
   bool get(tm_settings mask) {
+    GUARD(settings_lock_);
     return EVAL(settings_, mask);
   }
 
+  /**
+   * @brief Runs every queued task on the calling thread, against a virtual clock, the same way on every run
+   *
+   * The WORKER_COUNT workers are simulated, each task takes its COST (or what cost returns) of virtual time, and
+   * the seed picks the order workers take tasks in and the order of tasks finishing at the same time. The task
+   * manager is paused and left paused, so this should be done before start().
+   * @param seed uint64_t - The seed for the order of events
+   * @param cost function - How long a task takes, defaults to its COST setting, or 1ms without one
+   * @return sim_report - The virtual time taken and the trace of every task
+   */
+  sim_report simulate(uint64_t seed, std::function<std::chrono::nanoseconds(const task &)> cost = nullptr);
+
+  /**
+   * @brief Sets how many results of keyed tasks are kept, and for how long
+   * @param capacity size_t - The max amount of results kept, 0 to disable the cache
+   * @param ttl milliseconds - How long a result is kept for, 0 for forever
+   */
+  void set_cache(size_t capacity, std::chrono::milliseconds ttl = 0ms);
+
+  /**
+   * @brief Gets the counters for keyed tasks
+   * @return cache_stats - The hits, joins and misses so far
+   */
+  struct cache_stats get_cache_stats();
+
+  /**
+   * @brief Gets the usage of the tasks run for a pool, needs TRACK_USAGE
+   * @param pool string - The name of the pool
+   * @return task_stats - The usage of the pool's tasks
+   */
+  task_stats pool_stats(const std::string &pool);
+
+  /**
+   * @brief Gets the usage of the tasks run by a worker, needs TRACK_USAGE
+   * @param wid int - The worker ID
+   * @return task_stats - The usage of the worker's tasks
+   */
+  task_stats worker_stats(int wid);
+
+  /**
+   * @brief Gets the usage of the tasks run for every pool, needs TRACK_USAGE
+   * @return unordered_map<string, task_stats> - The usage by pool name
+   */
+  std::unordered_map<std::string, task_stats> pools_stats();
+
+  /**
+   * @brief Sets the share of the workers a pool gets when other pools also have tasks queued
+   *
+   * Pools take turns with deficit round robin, each turn a pool can start up to its weight in tasks.
+   * @param pool string - The name of the pool
+   * @param weight int - The weight, at least 1, pools default to 1
+   */
+  void set_weight(const std::string &pool, int weight);
+
+  /**
+   * @brief Gets a percentile of how long a pool's last tasks waited between being added and starting, needs TRACK_USAGE
+   * @param pool string - The name of the pool
+   * @param p double - The percentile, from 0 to 100
+   * @return nanoseconds - The wait
+   */
+  std::chrono::nanoseconds wait_percentile(const std::string &pool, double p);
+
+  /**
+   * @brief Sets how many tasks can be queued for a worker by affinity before more go to the shared queue
+   * @param limit size_t - The amount of tasks, default 1024
+   */
+  void set_spill(size_t limit);
+
+  /**
+   * @brief Sets how many tasks a worker has to have queued by affinity before idle workers steal from it
+   *
+   * Compensation workers, and any worker once the owner has stopped, steal whatever is queued.
+   * @param backlog size_t - The amount of tasks, default 16
+   */
+  void set_steal(size_t backlog);
+
+  /**
+   * @brief Gets the counters for tasks with an affinity
+   * @return affinity_stats - The local, stolen and spilled tasks so far
+   */
+  struct affinity_stats get_affinity_stats();
+
+  /**
+   * @brief Turns on compensation workers, which run queued tasks while workers are blocked
+   *
+   * A worker is blocked while it's in a blocking_region, or once its task has run longer than threshold.
+   * @param threshold milliseconds - How long a task runs before its worker counts as blocked, 0 to only use blocking_region
+   * @param cap int - The most compensation workers at once, up to WORKER_COUNT, 0 turns compensation off
+   */
+  void set_compensation(std::chrono::milliseconds threshold, int cap);
+
+  /**
+   * @brief Gets the counters for compensation workers
+   * @return compensation_stats - The spawned, retired and peak compensation workers so far
+   */
+  struct compensation_stats get_compensation_stats();
+
+  /**
+   * @brief Starts writing when, where and how long every task runs to a file, for replay
+   * @param path string - The path of the file, replaced if it exists
+   * @return bool - If the file could be opened
+   */
+  bool capture(const std::string &path);
+
+  /**
+   * @brief Stops capturing and writes out what's left
+   */
+  void stop_capture();
+
+  /**
+   * @brief Sends results to a function as tasks finish, instead of keeping them in pools
+   *
+   * Results are only kept in pools too with KEEP_POOLS. The sink is called from the workers, so a sink that blocks
+   * holds up its worker. This closes the channel of an earlier stream.
+   * @param sink result_sink - The function, nullptr to go back to keeping results in pools
+   */
+  void set_sink(result_sink sink);
+
+  /**
+   * @brief Sends results to a bounded channel as tasks finish, instead of keeping them in pools
+   *
+   * Workers wait while the channel is full, so memory stays bounded by how fast the results are taken. The channel
+   * closes once the workers stop, on stop, KILL_ON_EMPTY, or another set_sink, results after that are dropped.
+   * @param capacity size_t - The max amount of results held
+   * @return shared_ptr<channel<task_result>> - The channel to take results from
+   */
+  std::shared_ptr<channel<task_result>> stream(size_t capacity);
+
+  /**
+   * @brief Takes up to max results out of a pool, so a pool can be emptied a little at a time while tasks run
+   * @param pool string - The name of the pool
+   * @param max size_t - The most results taken
+   * @return vector<pair<int, string>> - The task IDs and results taken
+   */
+  std::vector<std::pair<int, std::string>> drain(const std::string &pool, size_t max);
+
+  /**
+   * @brief Marks a task as done without running it, so tasks AFTER it can run, e.g. when it finished before a restart
+   * @param name string - The name of the task
+   */
+  void mark_done(const std::string &name);
+
+  /**
+   * @brief Sets how many done task names are kept for AFTER, on top of the ones queued tasks are after
+   *
+   * By default every name is kept. A task added after the name it's after was dropped waits forever, so a limit should
+   * cover how far behind tasks are added, names done before a limit was set are kept.
+   * @param limit size_t - The amount of names, 0 to keep all of them
+   */
+  void set_done_limit(size_t limit);
+
   void clear_pool(const std::string &pool);
+  /**
+   * @brief Gets a copy of every pool's results, which can be large on long runs, see pool_sizes and drain
+   * @return unordered_map - The results by pool and task ID
+   */
   std::unordered_map<std::string, std::unordered_map<int, std::string>> pools();
+  /**
+   * @brief Gets how many results each pool has, without copying them
+   * @return unordered_map - The amount of results by pool
+   */
+  std::unordered_map<std::string, size_t> pool_sizes();
   std::unordered_map<int, std::string> pool(const std::string& name);
 
 };
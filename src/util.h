@@ -7,6 +7,8 @@
 
 #include <algorithm>
 #include <string>
+#include <sys/resource.h>
+#include <time.h>
 #include "task_manager.h"
 
 namespace unmined::util {
@@ -24,6 +26,8 @@ inline std::string to_string(std::deque<T> q);
 
 inline std::string to_string(const std::vector<std::string> &q);
 
+inline unmined::thread_usage usage();
+
 /**
  * @brief Checks if an array has a certain element
  * @tparam T The type of the array
@@ -79,6 +83,25 @@ inline std::string to_string(const std::vector<std::string> &q) {
   return out;
 }
 
+/**
+ * @brief Samples the time and context switches used by the calling thread
+ * @return thread_usage - The usage so far, wall time is from an arbitrary start
+ */
+inline unmined::thread_usage usage() {
+  unmined::thread_usage out;
+  out.wall = std::chrono::steady_clock::now().time_since_epoch();
+
+  timespec cpu{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  out.cpu = std::chrono::seconds(cpu.tv_sec) + std::chrono::nanoseconds(cpu.tv_nsec);
+
+  rusage ru{};
+  getrusage(RUSAGE_THREAD, &ru);
+  out.voluntary_switches = ru.ru_nvcsw;
+  out.involuntary_switches = ru.ru_nivcsw;
+  return out;
+}
+
 }
 
 #endif //TASK_MANAGER_SRC_UTIL_H_
@@ -0,0 +1,152 @@
+//
+// Created by christian on 10/18/26.
+//
+
+#ifndef TASK_MANAGER_SRC_WORKER_LOCAL_H_
+#define TASK_MANAGER_SRC_WORKER_LOCAL_H_
+
+#include <functional>
+#include <new>
+#include <vector>
+
+namespace unmined {
+
+namespace detail {
+
+/// The size values are padded and aligned to, so two workers' values never share a cache line
+constexpr size_t CACHE_LINE = 64;
+
+/**
+ * @brief The worker local values of one thread
+ */
+class local_storage {
+ private:
+  struct slot {
+    /// The worker_local the value belongs to
+    const void *owner;
+    void *value;
+    void (*destroy)(void *);
+  };
+
+  /// The values, in the order they were made
+  std::vector<slot> slots_;
+
+ public:
+  ~local_storage() {
+    clear();
+  }
+
+  /**
+   * @brief Finds the value of a worker_local
+   * @param owner void* - The worker_local
+   * @return void* - The value, or nullptr if it wasn't made yet
+   */
+  void *find(const void *owner) {
+    for (auto &s: slots_) {
+      if (s.owner == owner) return s.value;
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Adds the value of a worker_local
+   * @param owner void* - The worker_local
+   * @param value void* - The value
+   * @param destroy function - Destroys and frees the value
+   */
+  void add(const void *owner, void *value, void (*destroy)(void *)) {
+    slots_.push_back({owner, value, destroy});
+  }
+
+  /**
+   * @brief Destroys every value, newest first
+   */
+  void clear() {
+    while (!slots_.empty()) {
+      slot s = slots_.back();
+      slots_.pop_back();
+      s.destroy(s.value);
+    }
+  }
+};
+
+/// The worker local values of the calling thread
+inline thread_local local_storage storage;
+/// The values used instead of storage, set by simulate to the values of the virtual worker running a task
+inline thread_local local_storage *storage_override = nullptr;
+/// The ID of the worker the calling thread is, -1 if it isn't one
+inline thread_local int current_worker = -1;
+
+/**
+ * @brief Gets the worker local values of the worker running on the calling thread
+ * @return local_storage& - The values
+ */
+inline local_storage &current_storage() {
+  return storage_override ? *storage_override : storage;
+}
+
+}
+
+/**
+ * @brief Gets the ID of the worker running the calling task
+ * @return int - The worker ID, or -1 when not called from a worker
+ */
+inline int worker_id() {
+  return detail::current_worker;
+}
+
+/**
+ * @brief A value that each worker gets its own of, made the first time that worker uses it
+ *
+ * Workers destroy their values when they stop, after on_worker_stop, newest first. Under simulate each virtual worker
+ * has its own values, destroyed when simulate returns. Values are on their own cache lines. A worker_local should outlive the task manager, e.g. as a static, since values are found by its address.
+ * @tparam T The type of the value
+ */
+template<typename T>
+class worker_local {
+ private:
+  /// Makes the value for a worker
+  std::function<T()> make_;
+
+  static constexpr size_t SIZE = (sizeof(T) + detail::CACHE_LINE - 1) / detail::CACHE_LINE * detail::CACHE_LINE;
+  static constexpr std::align_val_t ALIGN{alignof(T) > detail::CACHE_LINE ? alignof(T) : detail::CACHE_LINE};
+
+  static void _destroy(void *p) {
+    static_cast<T *>(p)->~T();
+    ::operator delete(p, SIZE, ALIGN);
+  }
+
+ public:
+  /**
+   * @brief Makes a new worker local value
+   * @param make function - Makes the value for a worker, defaults to T()
+   */
+  explicit worker_local(std::function<T()> make = []() { return T(); }) : make_(std::move(make)) {}
+
+  worker_local(const worker_local &) = delete;
+  void operator=(const worker_local &) = delete;
+
+  /**
+   * @brief Gets the calling worker's value, making it if needed
+   * @return T& - The value
+   */
+  T &get() {
+    detail::local_storage &storage = detail::current_storage();
+    if (void *found = storage.find(this)) return *static_cast<T *>(found);
+    T *value = new(::operator new(SIZE, ALIGN)) T(make_());
+    storage.add(this, value, &_destroy);
+    return *value;
+  }
+
+  T &operator*() {
+    return get();
+  }
+
+  T *operator->() {
+    return &get();
+  }
+};
+
+}
+
+#endif //TASK_MANAGER_SRC_WORKER_LOCAL_H_
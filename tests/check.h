@@ -0,0 +1,37 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#ifndef TASK_MANAGER_TESTS_CHECK_H_
+#define TASK_MANAGER_TESTS_CHECK_H_
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <unistd.h>
+
+/// Ends the test with a failure if a condition doesn't hold, _exit since the task manager's threads may still be running
+#define CHECK(x) do { \
+  if (!(x)) { \
+    fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #x); \
+    _exit(1); \
+  } \
+} while (0)
+
+/**
+ * @brief Waits for a condition the workers make true
+ * @param done function - The condition
+ * @param timeout milliseconds - How long to wait, default 10s
+ * @return bool - If the condition held before the timeout
+ */
+inline bool wait_for(const std::function<bool()> &done, std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+  auto end = std::chrono::steady_clock::now() + timeout;
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > end) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+#endif //TASK_MANAGER_TESTS_CHECK_H_
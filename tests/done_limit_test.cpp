@@ -0,0 +1,44 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#include <string>
+#include "task_manager.hpp"
+#include "check.h"
+
+using namespace unmined;
+
+/**
+ * @brief Runs a task, then many others, then one after the first
+ * @param limit size_t - The done limit
+ * @return bool - If the last task ran
+ */
+bool late_runs(size_t limit) {
+  auto *tm = task_manager<2>::get_instance();
+  tm->set_done_limit(limit);
+  auto noop = []() { return retype{"", 0}; };
+  tm->add({"first", noop, {{AFTER, ""}, {POOL, "x"}}});
+  tm->start();
+  CHECK(wait_for([&]() { return tm->pool("x").size() == 1; }));
+  for (int i = 0; i < 100; ++i) tm->add({"t" + std::to_string(i), noop, {{AFTER, ""}, {POOL, "x"}}});
+  CHECK(wait_for([&]() { return tm->pool("x").size() == 101; }));
+
+  tm->add({"late", noop, {{AFTER, "first"}, {POOL, "late"}}});
+  bool ran = wait_for([&]() { return tm->pool_sizes()["late"] == 1; }, std::chrono::milliseconds(200));
+  if (!ran) {
+    // a dropped name can still be marked done by hand
+    tm->mark_done("first");
+    CHECK(wait_for([&]() { return tm->pool_sizes()["late"] == 1; }));
+  }
+  tm->stop();
+  tm->join();
+  return ran;
+}
+
+int main() {
+  // every name is kept by default
+  CHECK(late_runs(0));
+  // with a limit the old ones are dropped
+  CHECK(!late_runs(10));
+  return 0;
+}
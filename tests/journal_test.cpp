@@ -0,0 +1,79 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "task_manager.hpp"
+#include "check.h"
+
+using namespace unmined;
+
+std::string read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream out;
+  out << in.rdbuf();
+  return out.str();
+}
+
+int main() {
+  const std::string path = "journal_test.tmjnl";
+  unlink(path.c_str());
+  task_registry::get_instance()->add("echo", [](const std::string &args) { return retype{args, 0}; });
+
+  {
+    journal j(path, std::chrono::milliseconds(1));
+    CHECK(j.good());
+    for (int i = 0; i < 10; ++i) {
+      uint64_t seq = j.submit({0, "echo", "v" + std::to_string(i), "t" + std::to_string(i), "p", ""});
+      if (i < 6) j.complete(seq);
+    }
+    // after a task that completed, so it's marked done on recovery
+    j.submit({0, "echo", "after", "after", "p", "t0"});
+    CHECK(j.compact());
+    CHECK(j.sync());
+  }
+  // a record torn by a crash
+  {
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    CHECK(fd >= 0);
+    CHECK(write(fd, "\x01\xff\xff", 3) == 3);
+    close(fd);
+  }
+
+  {
+    auto j = std::make_shared<journal>(path, std::chrono::milliseconds(1));
+    CHECK(j->good());
+    CHECK(j->recovered().size() == 5);
+    CHECK(j->recovered().front().name == "t6");
+    CHECK(j->recovered().back().name == "after");
+
+    auto *tm = task_manager<2>::get_instance();
+    tm->set(KILL_ON_EMPTY, true);
+    CHECK(recover(tm, j) == 5);
+    tm->start();
+    tm->join();
+    auto results = tm->pool("p");
+    CHECK(results.size() == 5);
+    CHECK(j->sync());
+    CHECK(j->pending() == 0);
+  }
+  {
+    journal j(path);
+    CHECK(j.good());
+    CHECK(j.recovered().empty());
+  }
+  unlink(path.c_str());
+
+  // a file that isn't a journal is left alone
+  {
+    std::ofstream(path) << "not a journal";
+    journal j(path);
+    CHECK(!j.good());
+  }
+  CHECK(read_file(path) == "not a journal");
+  unlink(path.c_str());
+  return 0;
+}
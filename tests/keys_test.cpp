@@ -0,0 +1,56 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#include <atomic>
+#include <string>
+#include "task_manager.hpp"
+#include "check.h"
+
+using namespace unmined;
+
+int main() {
+  auto *tm = task_manager<2>::get_instance();
+  std::atomic<int> runs{0}, fails{0}, stops{0};
+  tm->task_fail_callback = [&](const task &, const int &, const int &) { fails++; };
+  tm->task_stop_callback = [&](const task &, const int &) { stops++; };
+  auto fetch = [&]() {
+    runs++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return retype{"page", 0};
+  };
+
+  // the first task with a key runs, the ones added while it's queued or running join it
+  for (int i = 0; i < 5; ++i) tm->add({"fetch" + std::to_string(i), fetch, {{AFTER, ""}, {POOL, "c"}, {KEY, "url"}}});
+  tm->start();
+  CHECK(wait_for([&]() { return tm->pool("c").size() == 5; }));
+  CHECK(runs == 1);
+  CHECK(stops == 5);
+  for (auto &[id, ret]: tm->pool("c")) CHECK(ret == "page");
+  cache_stats s = tm->get_cache_stats();
+  CHECK(s.misses == 1 && s.joins == 4 && s.hits == 0);
+
+  // once it's done, the result comes from the cache
+  tm->add({"fetch5", fetch, {{AFTER, ""}, {POOL, "c"}, {KEY, "url"}}});
+  CHECK(wait_for([&]() { return tm->pool("c").size() == 6; }));
+  CHECK(runs == 1);
+  CHECK(tm->get_cache_stats().hits == 1);
+
+  // a failure reaches every task that joined, and isn't cached
+  auto broken = [&]() {
+    runs++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return retype{"", -1};
+  };
+  for (int i = 0; i < 3; ++i) tm->add({"broken" + std::to_string(i), broken, {{AFTER, ""}, {POOL, "f"}, {KEY, "bad"}}});
+  CHECK(wait_for([&]() { return tm->pool("f").size() == 3; }));
+  CHECK(runs == 2);
+  CHECK(wait_for([&]() { return fails == 3; }));
+  tm->add({"broken3", broken, {{AFTER, ""}, {POOL, "f"}, {KEY, "bad"}}});
+  CHECK(wait_for([&]() { return tm->pool("f").size() == 4; }));
+  CHECK(runs == 3);
+
+  tm->stop();
+  tm->join();
+  return 0;
+}
@@ -0,0 +1,54 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#include <future>
+#include <string>
+#include <vector>
+#include "task_manager.hpp"
+#include "check.h"
+
+using namespace unmined;
+
+int main() {
+  task_registry::get_instance()->add("echo", [](const std::string &args) { return retype{args, 0}; });
+  task_registry::get_instance()->add("die", [](const std::string &) {
+    _exit(1);
+    return retype{"", 0};
+  });
+
+  // the request a worker dies on fails, the ones queued behind it go to its replacement
+  {
+    process_pool pool(2);
+    auto died = pool.submit("die", "");
+    std::vector<std::future<retype>> echoes;
+    for (int i = 0; i < 50; ++i) echoes.push_back(pool.submit("echo", std::to_string(i)));
+    CHECK(died.get().err == WORKER_DIED);
+    for (int i = 0; i < 50; ++i) {
+      retype r = echoes[i].get();
+      CHECK(r.err == 0 && r.ret == std::to_string(i));
+    }
+    CHECK(pool.respawns() >= 1);
+  }
+
+  // resending more than the socket holds, with results too big for the ring
+  {
+    process_pool pool(1, 4096);
+    std::string big(200 * 1024, 'x');
+    auto died = pool.submit("die", "");
+    std::vector<std::future<retype>> echoes;
+    for (int i = 0; i < 20; ++i) echoes.push_back(pool.submit("echo", big));
+    CHECK(died.get().err == WORKER_DIED);
+    for (auto &f: echoes) CHECK(f.get().ret.size() == big.size());
+    CHECK(pool.respawns() == 1);
+  }
+
+  // destroyed with requests still pending
+  {
+    process_pool pool(1, 4096);
+    std::string big(200 * 1024, 'x');
+    pool.submit("die", "");
+    for (int i = 0; i < 20; ++i) pool.submit("echo", big);
+  }
+  return 0;
+}
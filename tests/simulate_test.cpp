@@ -0,0 +1,64 @@
+//
+// Created by christian on 10/21/26.
+//
+
+#include <string>
+#include "task_manager.hpp"
+#include "check.h"
+
+using namespace unmined;
+
+/**
+ * @brief Simulates a graph of tasks over pools, affinities and costs on a fresh task manager
+ * @param seed uint64_t - The seed
+ * @return sim_report - The report
+ */
+sim_report run(uint64_t seed) {
+  auto *tm = task_manager<4>::get_instance();
+  for (int i = 0; i < 200; ++i) {
+    std::string n = std::to_string(i);
+    tm->add({"a" + n, []() { return retype{"", 0}; }, {
+        {AFTER, ""},
+        {POOL, "p" + std::to_string(i % 3)},
+        {COST, std::to_string(1000 + (i * 7919) % 5000)},
+    }});
+    tm->add({"b" + n, []() { return retype{"", 0}; }, {
+        {AFTER, "a" + n},
+        {POOL, "q"},
+        {COST, "700"},
+        {AFFINITY, std::to_string(i % 5)},
+    }});
+  }
+  sim_report r = tm->simulate(seed);
+  tm->stop();
+  tm->join();
+  return r;
+}
+
+int main() {
+  sim_report first = run(7);
+  CHECK(first.tasks == 400);
+  CHECK(first.stuck == 0);
+
+  // every task starts after the one it's after finished
+  std::unordered_map<std::string, const sim_event *> by_name;
+  for (auto &e: first.trace) by_name[e.name] = &e;
+  for (int i = 0; i < 200; ++i) {
+    std::string n = std::to_string(i);
+    CHECK(by_name.contains("a" + n) && by_name.contains("b" + n));
+    CHECK(by_name["b" + n]->start >= by_name["a" + n]->end);
+  }
+
+  // the same seed plays out the same way
+  sim_report second = run(7);
+  CHECK(second.makespan == first.makespan);
+  CHECK(second.requeues == first.requeues);
+  CHECK(second.trace.size() == first.trace.size());
+  for (size_t i = 0; i < first.trace.size(); ++i) {
+    CHECK(second.trace[i].name == first.trace[i].name);
+    CHECK(second.trace[i].wid == first.trace[i].wid);
+    CHECK(second.trace[i].start == first.trace[i].start);
+    CHECK(second.trace[i].end == first.trace[i].end);
+  }
+  return 0;
+}
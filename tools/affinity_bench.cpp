@@ -0,0 +1,69 @@
+//
+// Created by christian on 10/20/26.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+/// Each key's data, read by every task with that key, so a task runs faster on a worker whose cache already has it
+static std::vector<std::vector<uint64_t>> data;
+
+enum modes {
+  SHARED,
+  AFFINITY_STEAL,
+  AFFINITY_ONLY,
+};
+
+void run(modes mode, int keys, int tasks) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+  // everything is added up front, so none of it should spill to the shared queue
+  tm->set_spill(tasks);
+  if (mode == AFFINITY_ONLY) tm->set_steal(SIZE_MAX);
+
+  for (int i = 0; i < tasks; ++i) {
+    int key = i % keys;
+    tm->add({"t", [key]() {
+      uint64_t sum = 0;
+      for (auto v: data[key]) sum += v;
+      return retype{"", (int) (sum & 1)};
+    }, {
+        {AFTER, ""},
+        {POOL, "bench"},
+        {AFFINITY, mode == SHARED ? "" : std::to_string(key)},
+    }});
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  tm->start();
+  tm->join();
+  double ms = (double) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1e3;
+
+  affinity_stats s = tm->get_affinity_stats();
+  const char *names[] = {"shared queue", "affinity + steal", "affinity, no steal"};
+  printf("%-20s %10.1fms %12.0f tasks/s %8lu local %8lu stolen %8lu spilled\n",
+         names[mode], ms, tasks / ms * 1e3, s.local, s.stolen, s.spilled);
+  tm->stop();
+}
+
+int main(int argc, char **argv) {
+  int keys = argc > 1 ? std::stoi(argv[1]) : 8;
+  int tasks = argc > 2 ? std::stoi(argv[2]) : 20000;
+  size_t kib = argc > 3 ? std::stoul(argv[3]) : 512;
+  if (keys < 1 || tasks < 1) {
+    printf("usage: %s [keys = 8] [tasks = 20000] [KiB per key = 512]\n", argv[0]);
+    return 1;
+  }
+  data.assign(keys, std::vector<uint64_t>(kib * 1024 / sizeof(uint64_t), 1));
+
+  printf("%i tasks over %i keys of %zuKiB on 4 workers\n", tasks, keys, kib);
+  run(SHARED, keys, tasks);
+  run(AFFINITY_STEAL, keys, tasks);
+  run(AFFINITY_ONLY, keys, tasks);
+  return 0;
+}
@@ -0,0 +1,99 @@
+//
+// Created by christian on 10/20/26.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+  return (double) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1e3;
+}
+
+long transform(long v) {
+  return v * v % 1000003;
+}
+
+/**
+ * @brief Streams the items through a source, a stage and a sink joined by channels
+ * @return double - The milliseconds from the first add until the last task finished
+ */
+double run_channels(int items, size_t capacity, long &sum) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+
+  auto start = std::chrono::steady_clock::now();
+  auto raw = make_channel<long>(capacity);
+  auto done = make_channel<long>(capacity);
+  long next = 0;
+  tm->add(source<long>("source", raw, [&next, items](long &out) {
+    if (next == items) return false;
+    out = next++;
+    return true;
+  }));
+  tm->add(stage<long, long>("transform", raw, done, transform));
+  tm->add(sink<long>("sink", done, [&sum](long v) { sum += v; }));
+  tm->start();
+  tm->join();
+  double ms = ms_since(start);
+  tm->stop();
+  return ms;
+}
+
+/**
+ * @brief Runs every item as three tasks chained with AFTER
+ * @return double - The milliseconds from the first add until the last task finished
+ */
+double run_chained(int items, long &sum) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+
+  auto start = std::chrono::steady_clock::now();
+  std::mutex sum_lock;
+  for (int i = 0; i < items; ++i) {
+    std::string n = std::to_string(i);
+    auto slot = std::make_shared<long>(i);
+    tm->add({"p" + n, []() { return retype{"", 0}; }, {{AFTER, ""}, {POOL, "source"}}});
+    tm->add({"t" + n, [slot]() {
+      *slot = transform(*slot);
+      return retype{"", 0};
+    }, {{AFTER, "p" + n}, {POOL, "transform"}}});
+    tm->add({"s" + n, [slot, &sum, &sum_lock]() {
+      GUARD(sum_lock);
+      sum += *slot;
+      return retype{"", 0};
+    }, {{AFTER, "t" + n}, {POOL, "sink"}}});
+  }
+  tm->start();
+  tm->join();
+  double ms = ms_since(start);
+  tm->stop();
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int items = argc > 1 ? std::stoi(argv[1]) : 200'000;
+  size_t capacity = argc > 2 ? std::stoul(argv[2]) : 1024;
+  if (items < 1) {
+    printf("usage: %s [items = 200000] [channel capacity = 1024]\n", argv[0]);
+    return 1;
+  }
+
+  long streamed_sum = 0, chained_sum = 0;
+  double streamed = run_channels(items, capacity, streamed_sum);
+  double chained = run_chained(items, chained_sum);
+  printf("%i items through a source, a transform and a sink on 4 workers\n", items);
+  printf("%-24s %10.1fms %12.0f items/s\n", "channels", streamed, items / streamed * 1e3);
+  printf("%-24s %10.1fms %12.0f items/s\n", "AFTER chained tasks", chained, items / chained * 1e3);
+  if (streamed_sum != chained_sum) {
+    printf("the results differ, %li and %li\n", streamed_sum, chained_sum);
+    return 1;
+  }
+  return 0;
+}
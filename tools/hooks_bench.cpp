@@ -0,0 +1,76 @@
+//
+// Created by christian on 10/20/26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+/// Hooks that only count, so they can be inlined
+struct count_hooks {
+  std::atomic<uint64_t> finished{0};
+  void on_task_stop(const task &, int) { finished.fetch_add(1, std::memory_order_relaxed); }
+};
+
+/**
+ * @brief Runs tasks that do nothing with a hooks policy, on one worker so the hooks aren't lost in contention
+ * @return double - The nanoseconds per task, from starting the worker until the last task finished
+ */
+template<typename HOOKS>
+double run(int tasks) {
+  auto *tm = task_manager<1, HOOKS>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+  for (int i = 0; i < tasks; ++i) tm->add({"t", []() { return retype{"", 0}; }, {{AFTER, ""}, {POOL, "bench"}}});
+
+  auto start = std::chrono::steady_clock::now();
+  tm->start();
+  tm->join();
+  double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  tm->stop();
+  return ns / tasks;
+}
+
+/**
+ * @brief Runs a policy a few times, the first runs warm up the allocator and caches the later ones reuse
+ * @return vector<double> - The nanoseconds per task of each run, sorted
+ */
+template<typename HOOKS>
+std::vector<double> repeat(int tasks, int reps) {
+  std::vector<double> out;
+  for (int i = 0; i < reps; ++i) out.push_back(run<HOOKS>(tasks));
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+int main(int argc, char **argv) {
+  std::string policy = argc > 1 ? argv[1] : "";
+  int tasks = argc > 2 ? std::stoi(argv[2]) : 1'000'000;
+  int reps = argc > 3 ? std::stoi(argv[3]) : 5;
+  // one policy per process, so one doesn't run on a heap and caches another left warm
+  std::vector<double> ns;
+  const char *name = "";
+  if (policy == "callback") {
+    ns = repeat<callback_hooks>(tasks, reps);
+    name = "callback_hooks, callbacks unset";
+  } else if (policy == "count") {
+    ns = repeat<count_hooks>(tasks, reps);
+    name = "count_hooks, on_task_stop only";
+  } else if (policy == "none") {
+    ns = repeat<no_hooks>(tasks, reps);
+    name = "no_hooks";
+  }
+  if (ns.empty() || tasks < 1) {
+    printf("usage: %s <callback|count|none> [tasks = 1000000] [repetitions = 5]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%i empty tasks on 1 worker, %i runs\n", tasks, reps);
+  printf("%-32s %8.0fns/task min %8.0fns/task median\n", name, ns.front(), ns[ns.size() / 2]);
+  return 0;
+}
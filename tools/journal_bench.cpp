@@ -0,0 +1,87 @@
+//
+// Created by christian on 10/20/26.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+using clock_type = std::chrono::steady_clock;
+
+double ms_since(clock_type::time_point start) {
+  return (double) std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start).count() / 1e3;
+}
+
+/**
+ * @brief Runs tasks of a type that does nothing, with or without a journal
+ * @return double - The milliseconds from the first add until the last task finished
+ */
+double run(int tasks, const std::string &path, bool journaled) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+  std::shared_ptr<journal> j;
+  if (journaled) {
+    unlink(path.c_str());
+    j = std::make_shared<journal>(path);
+  }
+
+  auto start = clock_type::now();
+  for (int i = 0; i < tasks; ++i) {
+    std::string name = "t" + std::to_string(i);
+    if (journaled) add_journaled(tm, j, name, "noop", "args", "bench");
+    else tm->add({name, []() { return task_registry::get_instance()->run("noop", "args"); }, {{AFTER, ""}, {POOL, "bench"}}});
+  }
+  tm->start();
+  tm->join();
+  if (j) j->sync();
+  double ms = ms_since(start);
+  tm->stop();
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int tasks = argc > 1 ? std::stoi(argv[1]) : 1'000'000;
+  uint64_t entries = argc > 2 ? std::stoull(argv[2]) : 10'000'000;
+  std::string path = argc > 3 ? argv[3] : "journal_bench.tmjnl";
+  if (tasks < 1 || entries < 1) {
+    printf("usage: %s [tasks = 1000000] [entries = 10000000] [path = journal_bench.tmjnl]\n", argv[0]);
+    return 1;
+  }
+  task_registry::get_instance()->add("noop", [](const std::string &) { return retype{"", 0}; });
+
+  double plain = run(tasks, path, false);
+  double journaled = run(tasks, path, true);
+  printf("%i tasks on 4 workers\n", tasks);
+  printf("%-24s %10.1fms %8.0fns/task\n", "without a journal", plain, plain * 1e6 / tasks);
+  printf("%-24s %10.1fms %8.0fns/task\n", "journaled", journaled, journaled * 1e6 / tasks);
+  printf("%-24s %19.0fns/task\n", "overhead", (journaled - plain) * 1e6 / tasks);
+
+  // a journal a crash left behind, with 1 in 10 tasks pending
+  unlink(path.c_str());
+  {
+    journal j(path, std::chrono::milliseconds(2), UINT64_MAX);
+    for (uint64_t i = 0; i < entries; ++i) {
+      uint64_t seq = j.submit({0, "noop", "args", "t" + std::to_string(i), "bench", ""});
+      if (i % 10) j.complete(seq);
+    }
+    j.sync();
+  }
+  struct stat st{};
+  stat(path.c_str(), &st);
+
+  auto start = clock_type::now();
+  journal j(path, std::chrono::milliseconds(2), UINT64_MAX);
+  double recover = ms_since(start);
+  start = clock_type::now();
+  j.compact();
+  double compact = ms_since(start);
+  printf("%lu entries, %.1fMiB\n", entries, (double) st.st_size / (1 << 20));
+  printf("%-24s %10.1fms (%zu pending)\n", "recover", recover, j.recovered().size());
+  printf("%-24s %10.1fms\n", "compact", compact);
+  unlink(path.c_str());
+  return 0;
+}
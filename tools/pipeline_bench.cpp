@@ -0,0 +1,96 @@
+//
+// Created by christian on 10/20/26.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+struct parse {
+  long operator()(const std::string &in) const { return std::stol(in); }
+};
+struct transform {
+  long operator()(long v) const { return v * v % 1000003; }
+};
+struct store {
+  retype operator()(long v) const { return {std::to_string(v), 0}; }
+};
+
+using bench_pipeline = pipeline<parse, transform, store>;
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+  return (double) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1e3;
+}
+
+/**
+ * @brief Runs every item as one pipeline task
+ * @return double - The milliseconds from the first add until the last task finished
+ */
+double run_pipeline(int items) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < items; ++i) {
+    task t = bench_pipeline::make_task("s" + std::to_string(i), std::to_string(i));
+    t.settings[POOL] = "bench";
+    tm->add(t);
+  }
+  tm->start();
+  tm->join();
+  double ms = ms_since(start);
+  tm->stop();
+  return ms;
+}
+
+/**
+ * @brief Runs every item as three tasks chained with AFTER, passing values between them as strings
+ * @return double - The milliseconds from the first add until the last task finished
+ */
+double run_chained(int items) {
+  auto *tm = task_manager<4>::get_instance();
+  tm->pause();
+  tm->set(KILL_ON_EMPTY, true);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < items; ++i) {
+    std::string n = std::to_string(i);
+    auto slot = std::make_shared<std::string>(n);
+    tm->add({"p" + n, [slot]() {
+      *slot = std::to_string(parse{}(*slot));
+      return retype{"", 0};
+    }, {{AFTER, ""}, {POOL, "parse"}}});
+    tm->add({"t" + n, [slot]() {
+      *slot = std::to_string(transform{}(std::stol(*slot)));
+      return retype{"", 0};
+    }, {{AFTER, "p" + n}, {POOL, "transform"}}});
+    tm->add({"s" + n, [slot]() {
+      return store{}(std::stol(*slot));
+    }, {{AFTER, "t" + n}, {POOL, "bench"}}});
+  }
+  tm->start();
+  tm->join();
+  double ms = ms_since(start);
+  tm->stop();
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  int items = argc > 1 ? std::stoi(argv[1]) : 200'000;
+  if (items < 1) {
+    printf("usage: %s [items = 200000]\n", argv[0]);
+    return 1;
+  }
+
+  double piped = run_pipeline(items);
+  double chained = run_chained(items);
+  printf("%i items through parse, transform and store on 4 workers\n", items);
+  printf("%-24s %10.1fms %8.0fns/item\n", "pipeline", piped, piped * 1e6 / items);
+  printf("%-24s %10.1fms %8.0fns/item\n", "AFTER chained tasks", chained, chained * 1e6 / items);
+  return 0;
+}
@@ -0,0 +1,58 @@
+//
+// Created by christian on 10/19/26.
+//
+
+#include <cstdio>
+#include <string>
+#include "task_manager.hpp"
+
+using namespace unmined;
+
+template<int WORKER_COUNT>
+int run(const std::vector<capture_record> &records, double speed) {
+  auto *tm = task_manager<WORKER_COUNT>::get_instance();
+  tm->set(TRACK_USAGE, true);
+  replay_report r = replay(tm, records, speed);
+
+  printf("%lu tasks on %i workers in %.3fms\n", r.tasks, WORKER_COUNT, (double) r.makespan.count() / 1e6);
+  printf("%-24s %8s %12s %12s %12s %8s\n", "pool", "tasks", "wait p50", "wait p99", "max wall", "cpu");
+  for (auto &pool: r.pools) {
+    task_stats s = tm->pool_stats(pool);
+    printf("%-24s %8lu %10.3fms %10.3fms %10.3fms %8.2f\n",
+           pool.c_str(),
+           s.count,
+           (double) tm->wait_percentile(pool, 50).count() / 1e6,
+           (double) tm->wait_percentile(pool, 99).count() / 1e6,
+           (double) s.max_wall.count() / 1e6,
+           s.cpu_ratio());
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s <capture file> [workers = 4] [speed = 1]\n", argv[0]);
+    return 1;
+  }
+  auto records = read_capture(argv[1]);
+  if (records.empty()) {
+    printf("no tasks in %s\n", argv[1]);
+    return 1;
+  }
+  int workers = argc > 2 ? std::stoi(argv[2]) : 4;
+  double speed = argc > 3 ? std::stod(argv[3]) : 1;
+
+  // the worker count is a template argument, so only these can be picked
+  switch (workers) {
+    case 1: return run<1>(records, speed);
+    case 2: return run<2>(records, speed);
+    case 4: return run<4>(records, speed);
+    case 8: return run<8>(records, speed);
+    case 16: return run<16>(records, speed);
+    case 32: return run<32>(records, speed);
+    case 64: return run<64>(records, speed);
+    default:
+      printf("workers must be 1, 2, 4, 8, 16, 32 or 64\n");
+      return 1;
+  }
+}